@@ -1,26 +1,269 @@
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <compare>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <numeric>
+#include <mutex>
+#include <optional>
 #include <ranges>
 #include <set>
 #include <source_location>
+#include <span>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string.h>
 #include <errno.h>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 namespace make
 {
+	// Buffered logger writing from background thread, so printing never stalls scheduling of jobs.
+	// On terminal commands are shown in single status line that is rewritten in place,
+	// otherwise (CI logs, pipes, files) every message is printed in full.
+	struct Logger
+	{
+		enum class Level { Error, Warning, Info, Verbose };
+
+		// Messages less important than this level are dropped
+		Level verbosity = Level::Info;
+
+		// Whether standard output is terminal that can display status line
+		bool tty = [] {
+			char const* term = ::getenv("TERM");
+			return ::isatty(STDOUT_FILENO) && !(term && std::string_view(term) == "dumb");
+		}();
+
+		// Prints whole line, errors and warnings go to standard error
+		void print(Level level, std::string_view line)
+		{
+			if (level > verbosity) return;
+			std::string text(line);
+			text += '\n';
+			write(level <= Level::Warning ? STDERR_FILENO : STDOUT_FILENO, text);
+		}
+
+		// Queues raw text for any descriptor, so slow readers of it don't stall the caller
+		void write(int fd, std::string_view text)
+		{
+			{
+				std::lock_guard lock(queue_mutex);
+				if (pending.empty() || pending.back().first != fd) {
+					pending.emplace_back(fd, std::string{});
+				}
+				pending.back().second.append(text);
+			}
+			wake_writer();
+		}
+
+		// Replaces status line. Only most recent status is drawn, outside of terminal it's not printed at all.
+		void status(std::string_view line)
+		{
+			if (!tty) return;
+			{
+				std::lock_guard lock(queue_mutex);
+				next_status = line;
+			}
+			wake_writer();
+		}
+
+		// Replaces progress shown in front of status line, like status it's displayed only on terminal
+		void progress(std::string_view line)
+		{
+			if (!tty) return;
+			{
+				std::lock_guard lock(queue_mutex);
+				next_progress = line;
+			}
+			wake_writer();
+		}
+
+		// Reports started command: in status line on terminal, as full line otherwise
+		// or when command writes to the same terminal.
+		void command(std::string_view rendered, bool shares_output = false)
+		{
+			if (tty && !shares_output && verbosity < Level::Verbose) {
+				status(rendered);
+				return;
+			}
+			if (shares_output) {
+				// Status line redrawn after this line would be mixed with command's output
+				status("");
+			}
+			print(Level::Info, rendered);
+		}
+
+		// Writes everything queued so far before returning
+		void flush()
+		{
+			std::lock_guard lock(write_mutex);
+			write_pending();
+		}
+
+		~Logger()
+		{
+			if (writer.joinable()) {
+				{
+					std::lock_guard lock(queue_mutex);
+					stopping = true;
+				}
+				wake.notify_one();
+				writer.join();
+			}
+			flush();
+			if (status_shown) {
+				write_fd(STDOUT_FILENO, "\r\x1b[K");
+			}
+		}
+
+		std::mutex queue_mutex;
+		std::condition_variable wake;
+		// Chunks of lines for standard output and error, in order of printing
+		std::vector<std::pair<int, std::string>> pending{};
+		std::optional<std::string> next_status{};
+		std::optional<std::string> next_progress{};
+		bool stopping = false;
+
+		// Guards actual writes and state of status line
+		std::mutex write_mutex;
+		std::string shown_status{};
+		std::string shown_progress{};
+		bool status_shown = false;
+
+		std::thread writer{};
+		std::once_flag writer_started{};
+
+		void wake_writer()
+		{
+			std::call_once(writer_started, [this] { writer = std::thread([this] { write_loop(); }); });
+			wake.notify_one();
+		}
+
+		void write_loop()
+		{
+			for (;;) {
+				{
+					std::unique_lock lock(queue_mutex);
+					wake.wait(lock, [this] { return stopping || !pending.empty() || next_status || next_progress; });
+					if (stopping) return;
+				}
+				std::lock_guard lock(write_mutex);
+				write_pending();
+			}
+		}
+
+		// Writes queued lines, clearing status line before and redrawing it after them. Requires write_mutex.
+		void write_pending()
+		{
+			std::vector<std::pair<int, std::string>> lines;
+			std::optional<std::string> status, progress;
+			{
+				std::lock_guard lock(queue_mutex);
+				lines.swap(pending);
+				status.swap(next_status);
+				progress.swap(next_progress);
+			}
+			if (status) {
+				shown_status = std::move(*status);
+			}
+			if (progress) {
+				shown_progress = std::move(*progress);
+			}
+			bool const to_terminal = status || progress || std::ranges::any_of(lines, [](auto const& chunk) {
+				return chunk.first == STDOUT_FILENO || chunk.first == STDERR_FILENO;
+			});
+			if (!to_terminal) {
+				for (auto const& [fd, text] : lines) write_fd(fd, text);
+				return;
+			}
+
+			std::string out;
+			if (status_shown) {
+				out = "\r\x1b[K";
+				status_shown = false;
+			}
+			for (auto &[fd, text] : lines) {
+				if (fd == STDOUT_FILENO) {
+					out += text;
+				} else {
+					write_fd(STDOUT_FILENO, std::exchange(out, {}));
+					write_fd(fd, text);
+				}
+			}
+			if (tty && !(shown_status.empty() && shown_progress.empty())) {
+				auto line = shown_progress;
+				if (!line.empty() && !shown_status.empty()) line += ' ';
+				line += shown_status;
+
+				// Status longer than terminal would wrap and could not be rewritten in place
+				winsize size{};
+				auto const columns = ::ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 ? size.ws_col : 80u;
+				out.append(line, 0, columns - 1);
+				status_shown = true;
+			}
+			write_fd(STDOUT_FILENO, out);
+		}
+
+		static void write_fd(int fd, std::string_view data)
+		{
+			while (!data.empty()) {
+				auto const written = ::write(fd, data.data(), data.size());
+				if (written < 0 && errno == EINTR) continue;
+				if (written <= 0) return;
+				data.remove_prefix(written);
+			}
+		}
+	};
+
+	inline Logger logger;
+
+	namespace details
+	{
+		// Called once by panic before aborting, lets executor stop jobs and save what was done
+		inline std::function<void()> on_panic{};
+	}
+
 	[[noreturn]]
 	inline void panic(std::string why, std::source_location where = std::source_location::current())
 	{
-		std::cerr << "[ERROR] at " << where.file_name() << ':' << where.line() << ':' << where.column() << ": " << why << std::endl;
+		if (auto handler = std::exchange(details::on_panic, nullptr)) {
+			handler();
+		}
+		logger.print(Logger::Level::Error, "[ERROR] at " + std::string(where.file_name()) + ':' + std::to_string(where.line())
+			+ ':' + std::to_string(where.column()) + ": " + why);
+		logger.flush();
 		std::abort();
 	}
 
@@ -208,6 +451,378 @@ next_line:
 		std::filesystem::path c_header[] = { ".h" };
 		std::filesystem::path c_implementation[] = { ".c" };
 	}
+
+	// Dependency graph of files (sources including headers) stored as compressed sparse rows:
+	// edges of node n are targets[offsets[n]] .. targets[offsets[n + 1] - 1], and names of all
+	// files share one buffer, so even graphs with millions of edges are few contiguous arrays.
+	struct Dependency_Graph
+	{
+		using Node = std::uint32_t;
+
+		std::vector<std::uint32_t> offsets = { 0 };
+		std::vector<Node> targets{};
+
+		// Name of node n is names[name_offsets[n]] .. names[name_offsets[n + 1] - 1]
+		std::string names{};
+		std::vector<std::uint32_t> name_offsets = { 0 };
+
+		// Nodes ordered by name, for lookup
+		std::vector<Node> by_name{};
+
+		std::size_t size() const
+		{
+			return offsets.size() - 1;
+		}
+
+		std::span<Node const> edges(Node node) const
+		{
+			return std::span(targets).subspan(offsets[node], offsets[node + 1] - offsets[node]);
+		}
+
+		std::string_view name(Node node) const
+		{
+			return std::string_view(names).substr(name_offsets[node], name_offsets[node + 1] - name_offsets[node]);
+		}
+
+		std::optional<Node> find(std::string_view file) const
+		{
+			auto const it = std::ranges::lower_bound(by_name, file, {}, [this](Node node) { return name(node); });
+			if (it != by_name.end() && name(*it) == file) {
+				return *it;
+			}
+			return std::nullopt;
+		}
+
+		// Graph with all edges reversed, leading from headers to files that include them
+		Dependency_Graph transposed() const
+		{
+			Dependency_Graph result{ .names = names, .name_offsets = name_offsets, .by_name = by_name };
+			result.offsets.assign(size() + 1, 0);
+			for (auto target : targets) ++result.offsets[target + 1];
+			std::partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+
+			result.targets.resize(targets.size());
+			auto next = result.offsets;
+			for (Node node = 0; node < size(); ++node) {
+				for (auto target : edges(node)) result.targets[next[target]++] = node;
+			}
+			return result;
+		}
+
+		// Replaces edges of given files (adding files not yet in graph) in single pass over the graph,
+		// so applying results of rescanning many files costs the same as applying one.
+		void update(std::map<std::string, std::vector<std::string>, std::less<>> const& changed)
+		{
+			std::vector<std::pair<Node, std::vector<Node>>> rows;
+			// New nodes are appended with empty rows, by_name is restored after all of them were added
+			std::map<std::string_view, Node> added;
+			auto const node_of = [&](std::string_view file) {
+				if (auto node = find(file)) return *node;
+				auto [it, inserted] = added.try_emplace(file, Node(size()));
+				if (inserted) {
+					names += file;
+					name_offsets.push_back(names.size());
+					offsets.push_back(offsets.back());
+				}
+				return it->second;
+			};
+			for (auto const& [file, includes] : changed) {
+				auto &[node, row] = rows.emplace_back(node_of(file), std::vector<Node>{});
+				for (auto const& include : includes) row.push_back(node_of(include));
+				std::ranges::sort(row);
+				row.erase(std::ranges::unique(row).begin(), row.end());
+			}
+			std::ranges::sort(rows, {}, [](auto const& row) { return row.first; });
+
+			std::vector<std::uint32_t> new_offsets;
+			std::vector<Node> new_targets;
+			new_offsets.reserve(size() + 1);
+			new_targets.reserve(targets.size());
+			new_offsets.push_back(0);
+			auto row = rows.begin();
+			for (Node node = 0; node < size(); ++node) {
+				if (row != rows.end() && row->first == node) {
+					new_targets.insert(new_targets.end(), row->second.begin(), row->second.end());
+					++row;
+				} else {
+					auto const old = edges(node);
+					new_targets.insert(new_targets.end(), old.begin(), old.end());
+				}
+				new_offsets.push_back(new_targets.size());
+			}
+			offsets = std::move(new_offsets);
+			targets = std::move(new_targets);
+
+			if (by_name.size() != size()) {
+				by_name.resize(size());
+				std::iota(by_name.begin(), by_name.end(), Node(0));
+				std::ranges::sort(by_name, {}, [this](Node node) { return name(node); });
+			}
+		}
+
+		// Stores arrays of the graph as they are in memory, loading them back needs no parsing.
+		// Written to temporary file renamed over the old one, so interrupted save leaves previous graph intact.
+		void save(std::filesystem::path const& path) const
+		{
+			auto temporary = path;
+			temporary += ".tmp";
+			{
+				std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+				auto const write = [&](auto const& array) {
+					std::uint64_t const size = array.size();
+					file.write(reinterpret_cast<char const*>(&size), sizeof(size));
+					file.write(reinterpret_cast<char const*>(array.data()), size * sizeof(array[0]));
+				};
+				file.write(graph_magic.data(), graph_magic.size());
+				write(offsets);
+				write(targets);
+				write(names);
+				write(name_offsets);
+				write(by_name);
+			}
+			std::filesystem::rename(temporary, path);
+		}
+
+		// Loads graph written by save, missing or damaged file gives empty graph
+		static Dependency_Graph load(std::filesystem::path const& path)
+		{
+			Dependency_Graph graph;
+			std::ifstream file(path, std::ios::binary);
+			std::array<char, graph_magic.size()> magic{};
+			if (!file.read(magic.data(), magic.size()) || std::string_view(magic.data(), magic.size()) != graph_magic) {
+				return {};
+			}
+			auto const read = [&](auto &array) {
+				std::uint64_t size = 0;
+				if (!file.read(reinterpret_cast<char*>(&size), sizeof(size)) || size > (std::uint64_t(1) << 40)) return false;
+				array.resize(size);
+				return bool(file.read(reinterpret_cast<char*>(array.data()), size * sizeof(array[0])));
+			};
+			if (!read(graph.offsets) || !read(graph.targets) || !read(graph.names) || !read(graph.name_offsets) || !read(graph.by_name)) {
+				return {};
+			}
+
+			// Sanity checks, so corrupted file can't cause reads out of bounds
+			auto const nodes = graph.offsets.size() - 1;
+			if (graph.offsets.empty() || graph.name_offsets.size() != graph.offsets.size() || graph.by_name.size() != nodes
+				|| !std::ranges::is_sorted(graph.offsets) || graph.offsets.front() != 0 || graph.offsets.back() != graph.targets.size()
+				|| !std::ranges::is_sorted(graph.name_offsets) || graph.name_offsets.front() != 0 || graph.name_offsets.back() != graph.names.size()
+				|| std::ranges::any_of(graph.targets, [&](Node node) { return node >= nodes; })
+				|| std::ranges::any_of(graph.by_name, [&](Node node) { return node >= nodes; })) {
+				return {};
+			}
+			return graph;
+		}
+
+		static constexpr std::string_view graph_magic = "make.hh dependency graph 1\n";
+
+		// Builds graph from results of includes_in_directory, resolving includes like resolve does.
+		// Includes that can't be resolved (usually system headers) are skipped.
+		static Dependency_Graph from_scan(
+			std::map<std::filesystem::path, std::set<Include>> const& scan,
+			std::ranges::forward_range auto const& include_paths)
+		{
+			std::map<std::string, std::vector<std::string>, std::less<>> edges;
+			for (auto const& [file, file_includes] : scan) {
+				auto &row = edges[file.string()];
+				for (auto const& include : file_includes) {
+					if (auto header = resolve(include, include_paths, file.parent_path())) {
+						row.push_back(header->string());
+					}
+				}
+			}
+			Dependency_Graph graph;
+			graph.update(edges);
+			return graph;
+		}
+	};
+
+	// Reachability in dependency graph computed for all nodes at once. Include cycles are collapsed into
+	// strongly connected components, which are visited in reverse topological order, so set of columns
+	// reachable from a component is its own columns OR-ed with sets of its successors, word by word.
+	// Columns are selected nodes (e.g. translation units), bounding memory to components × columns bits.
+	struct Closure
+	{
+		using Node = Dependency_Graph::Node;
+
+		// Strongly connected component of each node
+		std::vector<std::uint32_t> component{};
+
+		std::vector<Node> columns{};
+
+		// Bitset of reachable columns for each component, words_per_row words each
+		std::size_t words_per_row = 0;
+		std::vector<std::uint64_t> rows{};
+
+		static Closure compute(Dependency_Graph const& graph, std::vector<Node> columns)
+		{
+			constexpr auto unvisited = std::numeric_limits<std::uint32_t>::max();
+			auto const nodes = graph.size();
+
+			Closure closure{ .component = std::vector<std::uint32_t>(nodes, unvisited), .columns = std::move(columns) };
+			closure.words_per_row = (closure.columns.size() + 63) / 64;
+
+			std::vector<std::vector<std::uint32_t>> columns_of(nodes);
+			for (std::uint32_t column = 0; column < closure.columns.size(); ++column) {
+				columns_of[closure.columns[column]].push_back(column);
+			}
+
+			// Tarjan's algorithm with explicit stack, since header hierarchies may be deep.
+			// Components are completed in reverse topological order, successors first.
+			std::vector<std::uint32_t> index(nodes, unvisited), low(nodes);
+			std::vector<Node> stack;
+			std::vector<bool> on_stack(nodes);
+			std::vector<std::pair<Node, std::uint32_t>> calls; // node and position in its edges
+			std::vector<std::uint32_t> merged; // last component that merged given one, to OR each successor once
+			std::uint32_t next_index = 0, components = 0;
+
+			auto const complete = [&](Node root) {
+				closure.rows.resize(closure.rows.size() + closure.words_per_row);
+				merged.push_back(unvisited);
+				auto begin = stack.size();
+				while (stack[--begin] != root) {}
+				for (auto i = begin; i < stack.size(); ++i) {
+					closure.component[stack[i]] = components;
+					on_stack[stack[i]] = false;
+				}
+
+				auto *const row = closure.rows.data() + std::size_t(components) * closure.words_per_row;
+				for (auto i = begin; i < stack.size(); ++i) {
+					for (auto column : columns_of[stack[i]]) row[column / 64] |= std::uint64_t(1) << (column % 64);
+					for (auto target : graph.edges(stack[i])) {
+						auto const successor = closure.component[target];
+						if (successor == components || merged[successor] == components) continue;
+						merged[successor] = components;
+						// Plain loop over words is vectorized by compiler where SIMD is available
+						auto const *source = closure.rows.data() + std::size_t(successor) * closure.words_per_row;
+						for (std::size_t word = 0; word < closure.words_per_row; ++word) row[word] |= source[word];
+					}
+				}
+				stack.resize(begin);
+				++components;
+			};
+
+			for (Node start = 0; start < nodes; ++start) {
+				if (index[start] != unvisited) continue;
+				calls.emplace_back(start, 0);
+				while (!calls.empty()) {
+					auto &[node, position] = calls.back();
+					if (position == 0) {
+						index[node] = low[node] = next_index++;
+						stack.push_back(node);
+						on_stack[node] = true;
+					}
+					auto const edges = graph.edges(node);
+					if (position < edges.size()) {
+						auto const target = edges[position++];
+						if (index[target] == unvisited) {
+							calls.emplace_back(target, 0);
+						} else if (on_stack[target]) {
+							low[node] = std::min(low[node], index[target]);
+						}
+						continue;
+					}
+
+					Node const finished = node;
+					calls.pop_back();
+					if (low[finished] == index[finished]) complete(finished);
+					if (!calls.empty()) {
+						auto const parent = calls.back().first;
+						low[parent] = std::min(low[parent], low[finished]);
+					}
+				}
+			}
+			return closure;
+		}
+
+		// Whether given column can be reached from node
+		bool reaches(Node from, std::size_t column) const
+		{
+			auto const row = std::size_t(component[from]) * words_per_row;
+			return rows[row + column / 64] >> (column % 64) & 1;
+		}
+
+		// Columns reachable from any of given nodes
+		std::vector<Node> reachable_from(std::span<Node const> nodes) const
+		{
+			std::vector<std::uint64_t> reached(words_per_row);
+			for (auto node : nodes) {
+				auto const *row = rows.data() + std::size_t(component[node]) * words_per_row;
+				for (std::size_t word = 0; word < words_per_row; ++word) reached[word] |= row[word];
+			}
+
+			std::vector<Node> result;
+			for (std::size_t word = 0; word < words_per_row; ++word) {
+				for (auto bits = reached[word]; bits; bits &= bits - 1) {
+					result.push_back(columns[word * 64 + std::countr_zero(bits)]);
+				}
+			}
+			return result;
+		}
+	};
+
+	// Units that must be rebuilt when given files changed, that is ones including any of them (directly or not)
+	// or changed themselves. Files unknown to the graph are ignored.
+	inline std::vector<std::string> dirty_units(
+		Dependency_Graph const& graph,
+		std::vector<std::string> const& units,
+		std::vector<std::string> const& changed)
+	{
+		auto const nodes_of = [&](std::vector<std::string> const& files) {
+			std::vector<Dependency_Graph::Node> nodes;
+			for (auto const& file : files) {
+				if (auto node = graph.find(file)) nodes.push_back(*node);
+			}
+			return nodes;
+		};
+
+		// In reversed graph units are reachable from headers they include
+		auto const closure = Closure::compute(graph.transposed(), nodes_of(units));
+
+		std::vector<std::string> dirty;
+		for (auto node : closure.reachable_from(nodes_of(changed))) {
+			dirty.emplace_back(graph.name(node));
+		}
+		return dirty;
+	}
+
+	// Latest modification time of each file of the graph and files it includes, directly or not.
+	// Files are visited from the most recently modified, marking everything that includes them unless
+	// marked already (by more recent file, which all its includers reach too), so each node is visited once.
+	inline std::vector<std::filesystem::file_time_type> latest_edits(Dependency_Graph const& graph)
+	{
+		using Node = Dependency_Graph::Node;
+		auto const reversed = graph.transposed();
+
+		std::vector<std::pair<std::filesystem::file_time_type, Node>> by_time;
+		for (Node node = 0; node < graph.size(); ++node) {
+			std::error_code ec;
+			auto const time = std::filesystem::last_write_time(graph.name(node), ec);
+			by_time.emplace_back(ec ? std::filesystem::file_time_type::min() : time, node);
+		}
+		std::ranges::sort(by_time, std::greater{});
+
+		std::vector<std::filesystem::file_time_type> latest(graph.size(), std::filesystem::file_time_type::min());
+		std::vector<bool> marked(graph.size());
+		std::vector<Node> pending;
+		for (auto const& [time, start] : by_time) {
+			if (marked[start]) continue;
+			marked[start] = true;
+			pending.push_back(start);
+			while (!pending.empty()) {
+				auto const node = pending.back();
+				pending.pop_back();
+				latest[node] = time;
+				for (auto includer : reversed.edges(node)) {
+					if (!marked[includer]) {
+						marked[includer] = true;
+						pending.push_back(includer);
+					}
+				}
+			}
+		}
+		return latest;
+	}
 }
 
 void demo_includes_resolution()
@@ -301,48 +916,114 @@ namespace make
 		return vector;
 	}
 
-	std::vector<std::string> cmd_parse(std::string_view command)
+	// Splits command into words following POSIX shell quoting rules (single and double quotes, backslash
+	// escapes), without expansions and without allocating. Words that don't need unquoting are views into
+	// command, others are unquoted into arena, which must be at least as big as command.
+	struct Cmd_Tokenizer
 	{
-		std::vector<std::string> args;
+		std::string_view command;
+		std::span<char> arena;
+		std::size_t arena_used = 0;
+		std::size_t position = 0;
+
+		// Set when command ends inside quotes or with lone backslash
+		char const* error = nullptr;
+
+		static constexpr bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\n'; }
 
-		char previous = '\0';
-		auto start = 0u;
-		for (auto i = 0u; i < command.size(); ++i) {
-			switch (command[i]) {
-			break; case '\'': case '"':
-				assert(false && "unimplemented");
+		std::optional<std::string_view> next()
+		{
+			while (position < command.size() && is_blank(command[position])) ++position;
+			if (position >= command.size()) return std::nullopt;
+
+			auto const start = position;
+			while (position < command.size() && !is_blank(command[position]) && !std::strchr("'\"\\", command[position])) ++position;
+			if (position >= command.size() || is_blank(command[position])) {
+				return command.substr(start, position - start);
+			}
+
+			assert(arena.size() >= command.size());
+			char *const word = arena.data() + arena_used;
+			char *out = std::copy(command.begin() + start, command.begin() + position, word);
 
-			break; case ' ':
-				if (previous != ' ' and i != 0u) {
-					args.emplace_back(command.substr(start, i - start));
+			enum { Unquoted, Single, Double } quoting = Unquoted;
+			for (; position < command.size(); ++position) {
+				char const c = command[position];
+				switch (quoting) {
+				break; case Unquoted:
+					if (is_blank(c)) goto word_end;
+					if (c == '\'') { quoting = Single; continue; }
+					if (c == '"')  { quoting = Double; continue; }
+					if (c == '\\') {
+						if (++position == command.size()) { error = "trailing backslash"; return std::nullopt; }
+						if (command[position] != '\n') *out++ = command[position];
+						continue;
+					}
+					*out++ = c;
+
+				break; case Single:
+					if (c == '\'') quoting = Unquoted;
+					else *out++ = c;
+
+				break; case Double:
+					if (c == '"') { quoting = Unquoted; continue; }
+					if (c == '\\' && position + 1 < command.size() && std::strchr("$`\"\\\n", command[position + 1])) {
+						if (command[++position] != '\n') *out++ = command[position];
+						continue;
+					}
+					*out++ = c;
 				}
-				start = i + 1;
 			}
-			previous = command[i];
+
+			if (quoting != Unquoted) {
+				error = "unterminated quote";
+				return std::nullopt;
+			}
+
+word_end:
+			arena_used = out - arena.data();
+			return std::string_view(word, out);
 		}
+	};
 
-		if (start < command.size() && command[start] != ' ') {
-			args.emplace_back(command.substr(start));
+	std::vector<std::string> cmd_parse(std::string_view command, std::source_location where = std::source_location::current())
+	{
+		std::vector<std::string> args;
+
+		auto arena = std::make_unique_for_overwrite<char[]>(command.size());
+		Cmd_Tokenizer tokenizer{ .command = command, .arena = { arena.get(), command.size() } };
+		while (auto word = tokenizer.next()) {
+			args.emplace_back(*word);
 		}
 
+		if (tokenizer.error) {
+			panic("Failed to parse command `" + std::string(command) + "`: " + tokenizer.error, where);
+		}
 		return args;
 	}
 
+	// Renders argv as shell command that cmd_parse (and shell) splits back into the same words
 	std::string cmd_render(std::vector<std::string> const& argv)
 	{
+		constexpr auto is_safe = [](char c) {
+			return std::isalnum(static_cast<unsigned char>(c)) || std::strchr("-_./=:,+@%^", c);
+		};
+
 		std::string cmd;
 		for (auto it = argv.begin(); it != argv.end(); ++it) {
 			if (it != argv.begin()) cmd += ' ';
 
-			if (it->find_first_of(" \"") != std::string::npos) {
-				cmd += '\'';
-				cmd += *it;
-				cmd += '\'';
-			} else if (it->find('\'') != std::string::npos) {
-				assert(0 && "unimplemented");
-			} else {
+			if (!it->empty() && std::ranges::all_of(*it, is_safe)) {
 				cmd += *it;
+				continue;
 			}
+
+			cmd += '\'';
+			for (char c : *it) {
+				if (c == '\'') cmd += "'\\''";
+				else cmd += c;
+			}
+			cmd += '\'';
 		}
 		return cmd;
 	}
@@ -363,99 +1044,3394 @@ namespace make
 		}
 	};
 
-	[[nodiscard]]
-	Status pid_wait(pid_t pid)
+	constexpr std::optional<Status> status_from_wait(int wstatus)
 	{
-		for (;;) {
-			int wstatus = 0;
-
-			if (::waitpid(pid, &wstatus, 0) < 0) {
-				panic(std::string("Failed to wait for process: ") + strerror(errno));
-			}
-
-			if (WIFEXITED(wstatus)) {
-				return Status { .exit_code = WEXITSTATUS(wstatus) };
-			}
+		if (WIFEXITED(wstatus)) {
+			return Status { .exit_code = WEXITSTATUS(wstatus) };
+		}
 
-			if (WIFSIGNALED(wstatus)) {
-				return Status { .kind = Status::SIGNAL, .exit_code = WTERMSIG(wstatus) };
-			}
+		if (WIFSIGNALED(wstatus)) {
+			return Status { .kind = Status::SIGNAL, .exit_code = WTERMSIG(wstatus) };
 		}
+
+		return std::nullopt;
 	}
 
-	[[nodiscard]]
-	Status cmd_run(std::vector<std::string> &argv)
+	namespace details
 	{
-		panic_if(argv.empty(), "couldn't execute empty command");
-		std::cout << "[CMD] " << cmd_render(argv) << std::endl;
-
-		auto child_pid = ::fork();
-		if (child_pid < 0) {
-			panic(std::string("Failed to execute command: ") + strerror(errno));
-		}
+		// PATH used by execvp when it isn't set
+		constexpr std::string_view default_path = "/bin:/usr/bin";
 
-		if (child_pid == 0) {
-			auto c_argv = std::make_unique<char*[]>(argv.size() + 1);
-			std::transform(argv.begin(), argv.end(), c_argv.get(), [](std::string &s) { return s.data(); });
-			::execvp(c_argv[0], c_argv.get());
-			panic(std::string("Failed to execute command: ") + strerror(errno));
-		}
+		// Environment materialized for execution: NAME=value strings and null terminated array of pointers to them
+		struct Envp
+		{
+			std::uint32_t id = 0;
+			std::vector<std::string> storage{};
+			std::vector<char*> pointers{};
 
-		return pid_wait(child_pid);
-	}
+			// Server remembers environments by id, so each one is sent only once
+			mutable bool sent_to_server = false;
 
-	struct Cmd
-	{
-		std::vector<std::string> argv{};
+			// Value of PATH in this environment
+			std::string_view path() const
+			{
+				for (std::string_view variable : storage) {
+					if (variable.starts_with("PATH=")) return variable.substr(5);
+				}
+				return default_path;
+			}
+		};
 
-		constexpr Cmd() = default;
+		inline std::uint32_t next_env_id = 1;
 
-		template<details::value_or_range<std::string> ...T>
-		explicit Cmd(T&& ...args)
+		// PATH of build script
+		inline std::string_view path()
 		{
-			append(argv, std::forward<T>(args)...);
+			auto const path = ::getenv("PATH");
+			return path ? path : default_path;
 		}
 
-		// run command and ensure that we returned success
-		void run_and_check(std::source_location where = std::source_location::current())
+		// Resolves executable name using PATH like execvp does. Results are cached by PATH value and name,
+		// so spawning doesn't try execve in every directory of PATH each time. Names with slash and names not
+		// found aren't resolved. Neither are names not found before relative or empty entry of PATH, since
+		// what execvp finds there depends on cwd of child.
+		inline std::optional<std::string> resolve_executable(std::string const& name, std::string_view path)
 		{
-			auto result = cmd_run(argv);
-			if (not result) {
-				switch (result.kind) {
-				break; case Status::EXIT:
-					panic("Command " + cmd_render(argv) + " returned non-zero exit code (exit_code = " + std::to_string(result.exit_code) + ")", where);
-				break; case Status::SIGNAL:
-					panic("Command " + cmd_render(argv) + " stopped with a signal: " + strsignal(result.signal), where);
-				}
+			if (name.empty() || name.find('/') != std::string::npos) {
+				return std::nullopt;
 			}
-		}
+
+			static std::map<std::string, std::map<std::string, std::string, std::less<>>, std::less<>> cache;
+			auto per_path = cache.find(path);
+			if (per_path == cache.end()) {
+				per_path = cache.emplace(std::string(path), std::map<std::string, std::string, std::less<>>{}).first;
+			}
+			if (auto it = per_path->second.find(name); it != per_path->second.end()) {
+				return it->second;
+			}
+
+			for (auto directory : std::views::split(path, ':')) {
+				std::string candidate(directory.begin(), directory.end());
+				if (candidate.empty() || candidate.front() != '/') return std::nullopt;
+				candidate += '/';
+				candidate += name;
+
+				struct stat info;
+				if (::stat(candidate.c_str(), &info) == 0 && S_ISREG(info.st_mode) && ::access(candidate.c_str(), X_OK) == 0) {
+					return per_path->second.emplace(name, candidate).first->second;
+				}
+			}
+			return std::nullopt;
+		}
+
+		inline std::vector<char*> environ_pointers()
+		{
+			std::vector<char*> pointers;
+			for (auto variable = environ; *variable; ++variable) pointers.push_back(*variable);
+			return pointers;
+		}
+
+		// Resources used by finished child process
+		struct Usage
+		{
+			double user_seconds = 0;
+			double system_seconds = 0;
+			long max_rss_kb = 0;
+		};
+
+		inline Usage usage_from_rusage(rusage const& usage)
+		{
+			return {
+				.user_seconds = double(usage.ru_utime.tv_sec) + usage.ru_utime.tv_usec / 1e6,
+				.system_seconds = double(usage.ru_stime.tv_sec) + usage.ru_stime.tv_usec / 1e6,
+				.max_rss_kb = usage.ru_maxrss,
+			};
+		}
+
+		// Usage of reaped children, until taken by whoever waits for them
+		inline std::map<pid_t, Usage> child_usage;
+
+		// Helper process started by spawn_server_start that forks and executes commands on our behalf.
+		// Forking it is cheap regardless of how large address space of the build script has grown.
+		struct Spawn_Server
+		{
+			int socket = -1;
+			pid_t pid = -1;
+
+			// Wait statuses of processes that finished, but nobody asked for them yet
+			std::map<pid_t, int> exited{};
+
+			// Entries of environ when server started (and learnt environment of build script).
+			// Since setenv and putenv replace entries, comparing pointers detects changes.
+			std::vector<char*> environ_snapshot{};
+			std::optional<Envp> inherited{};
+		};
+
+		inline Spawn_Server spawn_server;
+
+		// Sent by client, followed by payload of `size` bytes: cwd, resolved executable (may be empty), argv and
+		// environment as NUL terminated strings.
+		// Environment is sent only first time it's used (defines_env), server remembers it under env_id.
+		// env_id 0 means environment server started with. Standard file descriptors of the child are
+		// attached as SCM_RIGHTS.
+		// With nonzero signal it's request to signal process group led by kill_group instead, without payload.
+		struct Spawn_Request
+		{
+			std::uint32_t size = 0, argc = 0, envc = 0;
+			std::uint32_t env_id = 0, defines_env = 0;
+			std::uint32_t new_process_group = 0;
+			std::int32_t kill_group = 0, signal = 0;
+		};
+
+		// Sent by server, as response to request (Spawned) or when child finished (Exited)
+		struct Spawn_Message
+		{
+			enum : std::int32_t { Spawned, Exited } kind;
+			std::int32_t pid;
+			std::int32_t value; // errno for Spawned, wait status for Exited
+			Usage usage = {};   // of finished child for Exited
+		};
+
+		inline void write_all(int fd, void const* data, std::size_t size)
+		{
+			for (auto p = static_cast<char const*>(data); size > 0; ) {
+				auto const n = ::write(fd, p, size);
+				if (n < 0 && errno == EINTR) continue;
+				panic_if(n < 0, std::string("Failed to write: ") + strerror(errno));
+				p += n;
+				size -= n;
+			}
+		}
+
+		// Returns false on end of file
+		inline bool read_all(int fd, void *data, std::size_t size)
+		{
+			for (auto p = static_cast<char*>(data); size > 0; ) {
+				auto const n = ::read(fd, p, size);
+				if (n < 0 && errno == EINTR) continue;
+				panic_if(n < 0, std::string("Failed to read: ") + strerror(errno));
+				if (n == 0) return false;
+				p += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		inline void send_with_fds(int socket, void const* data, std::size_t size, std::span<int const> fds)
+		{
+			assert(fds.size() <= 3);
+			iovec iov { .iov_base = const_cast<void*>(data), .iov_len = size };
+			alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+			msghdr message{};
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+
+			if (!fds.empty()) {
+				message.msg_control = control;
+				message.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+
+				auto cmsg = CMSG_FIRSTHDR(&message);
+				cmsg->cmsg_level = SOL_SOCKET;
+				cmsg->cmsg_type = SCM_RIGHTS;
+				cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+				std::memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+			}
+
+			while (::sendmsg(socket, &message, 0) < 0) {
+				panic_if(errno != EINTR, std::string("Failed to send message to spawn server: ") + strerror(errno));
+			}
+		}
+
+		// Receives header with attached descriptors, returns number of descriptors or -1 on end of file
+		inline int receive_with_fds(int socket, void *data, std::size_t size, std::span<int> fds)
+		{
+			iovec iov { .iov_base = data, .iov_len = size };
+			alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+			msghdr message{};
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			ssize_t n;
+			while ((n = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+			if (n <= 0) return -1;
+
+			int count = 0;
+			for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+					count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+					std::memcpy(fds.data(), CMSG_DATA(cmsg), std::min<std::size_t>(count, fds.size()) * sizeof(int));
+				}
+			}
+
+			if (std::size_t(n) < size && !read_all(socket, static_cast<char*>(data) + n, size - n)) return -1;
+			return count;
+		}
+
+		[[noreturn]]
+		inline void spawn_server_main(int socket)
+		{
+			sigset_t sigchld, previous;
+			::sigemptyset(&sigchld);
+			::sigaddset(&sigchld, SIGCHLD);
+			::sigprocmask(SIG_BLOCK, &sigchld, &previous);
+			int const children = ::signalfd(-1, &sigchld, SFD_CLOEXEC);
+
+			// Environments registered by client: storage of strings and pointers to them
+			std::map<std::uint32_t, std::pair<std::string, std::vector<char*>>> environments;
+
+			// Children not reaped yet, whose pids can't be reused
+			std::set<pid_t> running;
+
+			// Interrupts are handled by build script, which terminates children when needed.
+			// Server exits by itself when build script closes connection.
+			::signal(SIGINT, SIG_IGN);
+			::signal(SIGTERM, SIG_IGN);
+
+			for (;;) {
+				pollfd fds[] = { { .fd = socket, .events = POLLIN, .revents = 0 }, { .fd = children, .events = POLLIN, .revents = 0 } };
+				if (::poll(fds, std::size(fds), -1) < 0) {
+					if (errno == EINTR) continue;
+					::_exit(1);
+				}
+
+				if (fds[1].revents & POLLIN) {
+					signalfd_siginfo info;
+					[[maybe_unused]] auto _ = ::read(children, &info, sizeof(info));
+					for (int wstatus; ; ) {
+						rusage usage;
+						pid_t const pid = ::wait4(-1, &wstatus, WNOHANG, &usage);
+						if (pid <= 0) break;
+						running.erase(pid);
+						Spawn_Message message { .kind = Spawn_Message::Exited, .pid = pid, .value = wstatus, .usage = usage_from_rusage(usage) };
+						write_all(socket, &message, sizeof(message));
+					}
+				}
+
+				if (fds[0].revents & (POLLIN | POLLHUP)) {
+					Spawn_Request request;
+					int passed[3];
+					int const passed_count = receive_with_fds(socket, &request, sizeof(request), passed);
+					if (passed_count < 0) ::_exit(0);
+
+					if (request.signal != 0) {
+						// Once leader is reaped its pid (and so pgid) may belong to unrelated process
+						if (running.contains(request.kill_group)) {
+							::kill(-request.kill_group, request.signal);
+						}
+						continue;
+					}
+
+					std::string payload(request.size, '\0');
+					if (!read_all(socket, payload.data(), payload.size())) ::_exit(0);
+
+					std::vector<char*> strings;
+					for (std::size_t i = 0; i < payload.size(); i += strlen(payload.data() + i) + 1) {
+						strings.push_back(payload.data() + i);
+					}
+					char *cwd = strings[0];
+					char *file = strings[1];
+					std::vector<char*> argv(strings.begin() + 2, strings.begin() + 2 + request.argc);
+					argv.push_back(nullptr);
+
+					if (request.defines_env) {
+						auto &[storage, envp] = environments[request.env_id];
+						storage.clear();
+						envp.clear();
+						if (request.envc > 0) {
+							storage.assign(payload, strings[2 + request.argc] - payload.data());
+						}
+						for (std::size_t i = 0; i < storage.size(); i += strlen(storage.data() + i) + 1) {
+							envp.push_back(storage.data() + i);
+						}
+						envp.push_back(nullptr);
+					}
+					char **envp = request.env_id == 0 ? environ : environments[request.env_id].second.data();
+
+					pid_t const pid = ::fork();
+					if (pid == 0) {
+						::sigprocmask(SIG_SETMASK, &previous, nullptr);
+						::signal(SIGINT, SIG_DFL);
+						::signal(SIGTERM, SIG_DFL);
+						if (request.new_process_group) {
+							::setpgid(0, 0);
+						}
+						for (int fd = 0; fd < passed_count; ++fd) {
+							::dup2(passed[fd], fd);
+						}
+						if (*cwd && ::chdir(cwd) < 0) {
+							std::fprintf(stderr, "[ERROR] Failed to change directory to %s: %s\n", cwd, strerror(errno));
+							::_exit(127);
+						}
+						environ = envp;
+						if (*file) ::execv(file, argv.data());
+						::execvp(argv[0], argv.data());
+						std::fprintf(stderr, "[ERROR] Failed to execute command: %s\n", strerror(errno));
+						::_exit(127);
+					}
+
+					for (int fd = 0; fd < passed_count; ++fd) {
+						::close(passed[fd]);
+					}
+					if (pid > 0) {
+						running.insert(pid);
+					}
+					if (pid > 0 && request.new_process_group) {
+						// Also set from parent, so group exists before anyone tries to signal it
+						::setpgid(pid, pid);
+					}
+
+					Spawn_Message message { .kind = Spawn_Message::Spawned, .pid = pid, .value = pid < 0 ? errno : 0 };
+					write_all(socket, &message, sizeof(message));
+				}
+			}
+		}
+
+		inline Spawn_Message spawn_server_receive()
+		{
+			Spawn_Message message;
+			panic_if(!read_all(spawn_server.socket, &message, sizeof(message)), "Spawn server closed connection");
+			if (message.kind == Spawn_Message::Exited) {
+				child_usage[message.pid] = message.usage;
+			}
+			return message;
+		}
+
+		inline pid_t spawn_server_spawn(
+			std::vector<std::string> const& argv,
+			std::filesystem::path const& cwd,
+			std::array<int, 3> const& stdio,
+			bool new_process_group,
+			Envp const* env,
+			std::string const& file)
+		{
+			if (!env) {
+				// Build script changed its environment since server learnt it
+				if (auto current = environ_pointers(); current != spawn_server.environ_snapshot) {
+					spawn_server.inherited = Envp { .id = next_env_id++ };
+					for (auto variable : current) spawn_server.inherited->storage.emplace_back(variable);
+					spawn_server.environ_snapshot = std::move(current);
+				}
+				if (spawn_server.inherited) {
+					env = &*spawn_server.inherited;
+				}
+			}
+
+			std::string payload = cwd.string();
+			payload += '\0';
+			payload += file;
+			payload += '\0';
+			for (auto const& arg : argv) {
+				payload += arg;
+				payload += '\0';
+			}
+
+			bool const defines_env = env && !env->sent_to_server;
+			if (defines_env) {
+				for (auto const& variable : env->storage) {
+					payload += variable;
+					payload += '\0';
+				}
+				env->sent_to_server = true;
+			}
+
+			Spawn_Request const request {
+				.size = std::uint32_t(payload.size()),
+				.argc = std::uint32_t(argv.size()),
+				.envc = defines_env ? std::uint32_t(env->storage.size()) : 0,
+				.env_id = env ? env->id : 0,
+				.defines_env = defines_env,
+				.new_process_group = new_process_group,
+			};
+			send_with_fds(spawn_server.socket, &request, sizeof(request), stdio);
+			write_all(spawn_server.socket, payload.data(), payload.size());
+
+			for (;;) {
+				auto const message = spawn_server_receive();
+				if (message.kind == Spawn_Message::Exited) {
+					spawn_server.exited.emplace(message.pid, message.value);
+					continue;
+				}
+				panic_if(message.pid < 0, std::string("Failed to execute command: ") + strerror(message.value));
+				return message.pid;
+			}
+		}
+
+		// Signals process group led by pid, unless its leader was already reaped
+		inline void kill_group(pid_t pid, int signal)
+		{
+			if (spawn_server.socket >= 0) {
+				// Only server knows whether it reaped the leader already
+				Spawn_Request const request { .kill_group = pid, .signal = signal };
+				send_with_fds(spawn_server.socket, &request, sizeof(request), {});
+			} else {
+				// Leader stays zombie until we wait for it, so its pid can't be reused
+				::kill(-pid, signal);
+			}
+		}
+
+		// Waits for next child to finish, ignoring already collected statuses
+		inline std::pair<pid_t, int> wait_next()
+		{
+			if (spawn_server.socket >= 0) {
+				auto const message = spawn_server_receive();
+				assert(message.kind == Spawn_Message::Exited);
+				return { message.pid, message.value };
+			}
+
+			for (;;) {
+				int wstatus = 0;
+				rusage usage;
+				if (pid_t const pid = ::wait4(-1, &wstatus, 0, &usage); pid >= 0) {
+					child_usage[pid] = usage_from_rusage(usage);
+					return { pid, wstatus };
+				}
+				if (errno != EINTR) {
+					panic(std::string("Failed to wait for process: ") + strerror(errno));
+				}
+			}
+		}
+	}
+
+	// Starts helper process which spawns all commands from now on. Call it at the very beginning
+	// of main, while address space of the build script is still small, since fork cost grows with it.
+	inline void spawn_server_start()
+	{
+		if (details::spawn_server.socket >= 0) {
+			return;
+		}
+
+		int sockets[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+			panic(std::string("Failed to create socket for spawn server: ") + strerror(errno));
+		}
+
+		std::cout.flush();
+		pid_t const pid = ::fork();
+		if (pid < 0) {
+			panic(std::string("Failed to start spawn server: ") + strerror(errno));
+		}
+
+		if (pid == 0) {
+			::close(sockets[0]);
+			details::spawn_server_main(sockets[1]);
+		}
+
+		::close(sockets[1]);
+		details::spawn_server.socket = sockets[0];
+		details::spawn_server.pid = pid;
+		details::spawn_server.environ_snapshot = details::environ_pointers();
+	}
+
+	// Waits for any child process to finish (including ones started by spawn server), returns its pid and wait status
+	inline std::pair<pid_t, int> wait_any()
+	{
+		auto &exited = details::spawn_server.exited;
+		if (!exited.empty()) {
+			auto node = exited.extract(exited.begin());
+			return { node.key(), node.mapped() };
+		}
+		return details::wait_next();
+	}
+
+	[[nodiscard]]
+	Status pid_wait(pid_t pid)
+	{
+		auto &server = details::spawn_server;
+		if (auto node = server.exited.extract(pid)) {
+			details::child_usage.erase(pid);
+			return *status_from_wait(node.mapped());
+		}
+
+		for (;;) {
+			int wstatus = 0;
+
+			if (server.socket >= 0) {
+				auto const [finished, finished_status] = details::wait_next();
+				if (finished != pid) {
+					server.exited.emplace(finished, finished_status);
+					continue;
+				}
+				wstatus = finished_status;
+			} else if (::waitpid(pid, &wstatus, 0) < 0) {
+				if (errno == EINTR) continue;
+				panic(std::string("Failed to wait for process: ") + strerror(errno));
+			}
+
+			if (auto status = status_from_wait(wstatus)) {
+				details::child_usage.erase(pid);
+				return *status;
+			}
+		}
+	}
+
+	// Standard input, output and error of child process
+	using Stdio = std::array<int, 3>;
+
+	constexpr Stdio inherited_stdio = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+	// Starts command in child process without waiting for it to finish.
+	// When cwd is not empty, child changes working directory before executing command.
+	// With new_process_group child leads its own process group (with pgid equal to its pid),
+	// so it can be signaled together with all processes it started.
+	// Child gets given environment, or environment of build script when env is null.
+	[[nodiscard]]
+	pid_t cmd_spawn(
+		std::vector<std::string> &argv,
+		std::filesystem::path const& cwd = {},
+		Stdio const& stdio = inherited_stdio,
+		bool new_process_group = false,
+		details::Envp const* env = nullptr)
+	{
+		panic_if(argv.empty(), "couldn't execute empty command");
+		bool const shares_output = stdio[1] == STDOUT_FILENO || stdio[2] == STDERR_FILENO;
+		logger.command("[CMD] " + cmd_render(argv), shares_output);
+		if (shares_output) {
+			// Output of child shouldn't overtake line announcing it
+			logger.flush();
+		}
+
+		std::string const file = details::resolve_executable(argv[0], env ? env->path() : details::path()).value_or("");
+
+		if (details::spawn_server.socket >= 0) {
+			return details::spawn_server_spawn(argv, cwd, stdio, new_process_group, env, file);
+		}
+
+		auto child_pid = ::fork();
+		if (child_pid < 0) {
+			panic(std::string("Failed to execute command: ") + strerror(errno));
+		}
+
+		if (child_pid == 0) {
+			if (new_process_group) {
+				::setpgid(0, 0);
+			}
+			for (int fd = 0; fd < int(stdio.size()); ++fd) {
+				if (stdio[fd] != fd) ::dup2(stdio[fd], fd);
+			}
+			// Logger may be locked by its writer thread that doesn't exist in child, so errors are reported directly
+			if (!cwd.empty() && ::chdir(cwd.c_str()) < 0) {
+				std::fprintf(stderr, "[ERROR] Failed to change directory to %s: %s\n", cwd.c_str(), strerror(errno));
+				::_exit(127);
+			}
+			auto c_argv = std::make_unique<char*[]>(argv.size() + 1);
+			std::transform(argv.begin(), argv.end(), c_argv.get(), [](std::string &s) { return s.data(); });
+			if (env) {
+				// execvp searches PATH of the new environment then
+				environ = const_cast<char**>(env->pointers.data());
+			}
+			if (!file.empty()) {
+				::execv(file.c_str(), c_argv.get());
+			}
+			// Not resolved or resolved file disappeared since it was cached
+			::execvp(c_argv[0], c_argv.get());
+			std::fprintf(stderr, "[ERROR] Failed to execute command: %s\n", strerror(errno));
+			::_exit(127);
+		}
+
+		if (new_process_group) {
+			::setpgid(child_pid, child_pid);
+		}
+		return child_pid;
+	}
+
+	[[nodiscard]]
+	Status cmd_run(std::vector<std::string> &argv, std::filesystem::path const& cwd = {})
+	{
+		return pid_wait(cmd_spawn(argv, cwd));
+	}
+
+	// Output of command run with Cmd::capture
+	struct Captured
+	{
+		Status status;
+		std::string out{};
+		std::string err{};
+	};
+
+	namespace details
+	{
+		// Reads all available data from descriptors into corresponding buffers until end of file on all of them.
+		// Reads directly into buffer's storage with geometrically growing chunks.
+		inline void read_all_into(std::span<std::pair<int, std::string*> const> sources)
+		{
+			std::vector<pollfd> fds;
+			// Bytes read into each buffer, rest of it is space for following reads
+			std::vector<std::size_t> used;
+			for (auto [fd, buffer] : sources) {
+				fds.push_back({ .fd = fd, .events = POLLIN, .revents = 0 });
+				used.push_back(buffer->size());
+			}
+
+			for (auto open = fds.size(); open > 0; ) {
+				if (::poll(fds.data(), fds.size(), -1) < 0) {
+					panic_if(errno != EINTR, std::string("Failed to poll pipes: ") + strerror(errno));
+					continue;
+				}
+
+				for (auto i = 0u; i < fds.size(); ++i) {
+					if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+					// Grown geometrically only when full, so zero filling new space stays linear in output size
+					auto &buffer = *sources[i].second;
+					if (used[i] == buffer.size()) {
+						buffer.resize(std::max<std::size_t>(buffer.size() * 2, buffer.size() + (1 << 16)));
+					}
+
+					auto const n = ::read(fds[i].fd, buffer.data() + used[i], buffer.size() - used[i]);
+					if (n > 0) used[i] += n;
+
+					if (n < 0 && errno == EINTR) continue;
+					panic_if(n < 0, std::string("Failed to read command output: ") + strerror(errno));
+					if (n == 0) {
+						::close(fds[i].fd);
+						fds[i].fd = -1;
+						--open;
+					}
+				}
+			}
+
+			for (auto i = 0u; i < sources.size(); ++i) {
+				sources[i].second->resize(used[i]);
+			}
+		}
+	}
+
+	// Changes of environment relative to the one of build script
+	struct Environment
+	{
+		// Start from empty environment instead of build script's one
+		bool clear = false;
+
+		// Variables to set, or to unset when std::nullopt
+		std::map<std::string, std::optional<std::string>> changes{};
+
+		auto operator<=>(Environment const&) const = default;
+
+		bool inherited() const { return !clear && changes.empty(); }
+	};
+
+	namespace details
+	{
+		// Materializes environment once per distinct one (for the whole run of build script, based on
+		// environment of build script at that time), so spawning doesn't need to rebuild it.
+		// Returns null for inherited environment.
+		inline Envp const* envp_for(Environment const& env)
+		{
+			if (env.inherited()) {
+				return nullptr;
+			}
+
+			static std::map<Environment, Envp> cache;
+
+			// Build script changed its environment, which environments not cleared are based on
+			static std::vector<char*> environ_snapshot = environ_pointers();
+			if (auto current = environ_pointers(); current != environ_snapshot) {
+				std::erase_if(cache, [](auto const& entry) { return !entry.first.clear; });
+				environ_snapshot = std::move(current);
+			}
+
+			if (auto it = cache.find(env); it != cache.end()) {
+				return &it->second;
+			}
+
+			std::map<std::string_view, std::string_view> variables;
+			if (!env.clear) {
+				for (auto variable = environ; *variable; ++variable) {
+					std::string_view v = *variable;
+					auto const equal = v.find('=');
+					variables[v.substr(0, equal)] = v;
+				}
+			}
+
+			Envp envp { .id = next_env_id++ };
+			for (auto const& [name, value] : env.changes) {
+				variables.erase(name);
+			}
+			for (auto const& [_, variable] : variables) {
+				envp.storage.emplace_back(variable);
+			}
+			for (auto const& [name, value] : env.changes) {
+				if (value) envp.storage.push_back(name + '=' + *value);
+			}
+			for (auto &variable : envp.storage) {
+				envp.pointers.push_back(variable.data());
+			}
+			envp.pointers.push_back(nullptr);
+
+			return &cache.emplace(env, std::move(envp)).first->second;
+		}
+	}
+
+	struct Cmd
+	{
+		std::vector<std::string> argv{};
+
+		// Working directory of the command, empty means the current one
+		std::filesystem::path cwd{};
+
+		Environment env{};
+
+		constexpr Cmd() = default;
+
+		template<details::value_or_range<std::string> ...T>
+		explicit Cmd(T&& ...args)
+		{
+			append(argv, std::forward<T>(args)...);
+		}
+
+		Cmd& set_env(std::string name, std::string value)
+		{
+			env.changes.insert_or_assign(std::move(name), std::move(value));
+			return *this;
+		}
+
+		Cmd& unset_env(std::string name)
+		{
+			env.changes.insert_or_assign(std::move(name), std::nullopt);
+			return *this;
+		}
+
+		// Run with empty environment, except variables set with set_env
+		Cmd& clear_env()
+		{
+			env.clear = true;
+			return *this;
+		}
+
+		// Starts command without waiting for it, see cmd_spawn
+		[[nodiscard]]
+		pid_t spawn(Stdio const& stdio = inherited_stdio, bool new_process_group = false)
+		{
+			return cmd_spawn(argv, cwd, stdio, new_process_group, details::envp_for(env));
+		}
+
+		// Runs command and waits for it to finish
+		[[nodiscard]]
+		Status run()
+		{
+			return pid_wait(spawn());
+		}
+
+		enum class Stderr { Inherit, Separate, Merge };
+
+		// Run command and collect its standard output (and optionally error, either separately or merged
+		// into output), without involving shell.
+		[[nodiscard]]
+		Captured capture(Stderr err = Stderr::Inherit)
+		{
+			int out_pipe[2], err_pipe[2] = { -1, -1 };
+			panic_if(::pipe2(out_pipe, O_CLOEXEC) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+			if (err == Stderr::Separate) {
+				panic_if(::pipe2(err_pipe, O_CLOEXEC) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+			}
+
+			Stdio stdio = inherited_stdio;
+			stdio[STDOUT_FILENO] = out_pipe[1];
+			if (err == Stderr::Separate) stdio[STDERR_FILENO] = err_pipe[1];
+			if (err == Stderr::Merge)    stdio[STDERR_FILENO] = out_pipe[1];
+
+			auto const pid = spawn(stdio);
+			::close(out_pipe[1]);
+			if (err_pipe[1] >= 0) ::close(err_pipe[1]);
+
+			Captured captured{};
+			std::vector<std::pair<int, std::string*>> sources = { { out_pipe[0], &captured.out } };
+			if (err_pipe[0] >= 0) {
+				sources.emplace_back(err_pipe[0], &captured.err);
+			}
+			details::read_all_into(sources);
+
+			captured.status = pid_wait(pid);
+			return captured;
+		}
+
+		// run command and ensure that we returned success
+		void run_and_check(std::source_location where = std::source_location::current())
+		{
+			auto result = run();
+			if (not result) {
+				switch (result.kind) {
+				break; case Status::EXIT:
+					panic("Command " + cmd_render(argv) + " returned non-zero exit code (exit_code = " + std::to_string(result.exit_code) + ")", where);
+				break; case Status::SIGNAL:
+					panic("Command " + cmd_render(argv) + " stopped with a signal: " + strsignal(result.signal), where);
+				}
+			}
+		}
+	};
+
+	void append(Cmd &cmd, auto&& ...args)
+		requires requires { {append(cmd.argv, std::forward<decltype(args)>(args)...)}; }
+	{
+		append(cmd.argv, std::forward<decltype(args)>(args)...);
+	}
+
+	namespace details
+	{
+		// Moves data from first to second descriptor of each pair until end of file, closing both
+		// when done. Pairs are served concurrently, so stalled one doesn't block others.
+		// Returns number of transferred bytes.
+		inline std::size_t splice_links(std::vector<std::pair<int, int>> links)
+		{
+			std::size_t transferred = 0;
+			std::vector<bool> output_full(links.size(), false);
+
+			// Stage that finished early must not take build script with it
+			auto const previous_sigpipe = ::signal(SIGPIPE, SIG_IGN);
+
+			auto const finish = [&](std::size_t i) {
+				::close(links[i].first);
+				::close(links[i].second);
+				links[i] = { -1, -1 };
+			};
+
+			for (;;) {
+				std::vector<pollfd> fds;
+				for (auto i = 0u; i < links.size(); ++i) {
+					if (links[i].first < 0) continue;
+					fds.push_back(output_full[i]
+						? pollfd { .fd = links[i].second, .events = POLLOUT, .revents = 0 }
+						: pollfd { .fd = links[i].first,  .events = POLLIN,  .revents = 0 });
+				}
+				if (fds.empty()) {
+					::signal(SIGPIPE, previous_sigpipe);
+					return transferred;
+				}
+
+				if (::poll(fds.data(), fds.size(), -1) < 0) {
+					panic_if(errno != EINTR, std::string("Failed to poll pipes: ") + strerror(errno));
+					continue;
+				}
+
+				for (auto i = 0u; i < links.size(); ++i) {
+					if (links[i].first < 0) continue;
+
+					auto const n = ::splice(links[i].first, nullptr, links[i].second, nullptr, 1 << 16, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+					if (n > 0) {
+						transferred += n;
+						output_full[i] = false;
+					} else if (n == 0) {
+						finish(i);
+					} else if (errno == EAGAIN) {
+						// Either there is nothing to read or no space to write, check which one
+						pollfd output { .fd = links[i].second, .events = POLLOUT, .revents = 0 };
+						output_full[i] = ::poll(&output, 1, 0) == 0;
+					} else if (errno == EPIPE) {
+						// Reading stage finished early, writing one will get SIGPIPE like in a regular pipe
+						finish(i);
+					} else if (errno != EINTR) {
+						panic(std::string("Failed to splice between pipes: ") + strerror(errno));
+					}
+				}
+			}
+		}
+	}
+
+	// Commands connected with pipes (stdout of each stage goes to stdin of the next one),
+	// with optional redirection of input of the first stage and output of the last one.
+	struct Pipeline
+	{
+		std::vector<Cmd> stages{};
+
+		// Files used as standard input of the first stage and standard output of the last one, empty means inherited
+		std::filesystem::path input{};
+		std::filesystem::path output{};
+		bool append_output = false;
+
+		// Connect stages through build script instead of directly. Data is moved between pipes with splice,
+		// without copying it to user space, and amount of it is counted in relayed_bytes.
+		bool relay = false;
+		std::size_t relayed_bytes = 0;
+
+		Pipeline&& read_from(std::filesystem::path path) &&
+		{
+			input = std::move(path);
+			return std::move(*this);
+		}
+
+		Pipeline&& write_to(std::filesystem::path path) &&
+		{
+			output = std::move(path);
+			append_output = false;
+			return std::move(*this);
+		}
+
+		Pipeline&& append_to(std::filesystem::path path) &&
+		{
+			output = std::move(path);
+			append_output = true;
+			return std::move(*this);
+		}
+
+		// Runs all stages and waits for them. Like shell's pipefail, returns status of the first stage
+		// that didn't succeed or success when all of them did.
+		[[nodiscard]]
+		Status run()
+		{
+			panic_if(stages.empty(), "couldn't execute empty pipeline");
+
+			auto const open_or = [](std::filesystem::path const& path, int flags, int fallback) {
+				if (path.empty()) return fallback;
+				int const fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+				panic_if(fd < 0, "Failed to open " + path.string() + ": " + strerror(errno));
+				return fd;
+			};
+
+			int input_fd = open_or(input, O_RDONLY, STDIN_FILENO);
+			int const output_fd = open_or(output, O_WRONLY | O_CREAT | (append_output ? O_APPEND : O_TRUNC), STDOUT_FILENO);
+
+			// Ends of pipes kept by build script when relaying: stage i writes to .first, stage i+1 reads from .second
+			std::vector<std::pair<int, int>> links;
+			std::vector<pid_t> pids;
+
+			for (auto i = 0u; i < stages.size(); ++i) {
+				Stdio stdio = { input_fd, output_fd, STDERR_FILENO };
+				int next_input = -1;
+
+				if (i + 1 < stages.size()) {
+					int pipe[2];
+					panic_if(::pipe2(pipe, O_CLOEXEC) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+					stdio[STDOUT_FILENO] = pipe[1];
+					next_input = pipe[0];
+
+					if (relay) {
+						int relayed[2];
+						panic_if(::pipe2(relayed, O_CLOEXEC) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+						links.emplace_back(pipe[0], relayed[1]);
+						next_input = relayed[0];
+					}
+				}
+
+				pids.push_back(stages[i].spawn(stdio));
+
+				if (stdio[STDIN_FILENO] != STDIN_FILENO) ::close(stdio[STDIN_FILENO]);
+				if (stdio[STDOUT_FILENO] != STDOUT_FILENO && stdio[STDOUT_FILENO] != output_fd) ::close(stdio[STDOUT_FILENO]);
+				input_fd = next_input;
+			}
+			if (output_fd != STDOUT_FILENO) ::close(output_fd);
+
+			relayed_bytes += details::splice_links(links);
+
+			Status result{};
+			for (auto pid : pids) {
+				if (auto status = pid_wait(pid); result && !status) {
+					result = status;
+				}
+			}
+			return result;
+		}
+
+		std::string render() const
+		{
+			std::string rendered;
+			if (!input.empty()) {
+				rendered += "< " + cmd_render({ input.string() }) + ' ';
+			}
+			for (auto const& stage : stages) {
+				if (&stage != &stages.front()) rendered += " | ";
+				rendered += cmd_render(stage.argv);
+			}
+			if (!output.empty()) {
+				rendered += (append_output ? " >> " : " > ") + cmd_render({ output.string() });
+			}
+			return rendered;
+		}
+
+		void run_and_check(std::source_location where = std::source_location::current())
+		{
+			if (auto result = run(); not result) {
+				panic("Pipeline " + render() + " failed (exit_code = " + std::to_string(result.normalize_to_exit_code()) + ")", where);
+			}
+		}
+	};
+
+	inline Pipeline operator|(Cmd lhs, Cmd rhs)
+	{
+		return Pipeline{ .stages = { std::move(lhs), std::move(rhs) } };
+	}
+
+	inline Pipeline operator|(Pipeline lhs, Cmd rhs)
+	{
+		lhs.stages.push_back(std::move(rhs));
+		return lhs;
+	}
+
+	using Clock = std::chrono::steady_clock;
+
+	// Durations of previous runs of jobs, persisted between invocations of build script.
+	// Keys are job names (usually path of produced file), values are seconds of wall time
+	// and peak memory of the latest run, together with few runs before it for finding regressions.
+	struct Build_Log
+	{
+		struct Sample
+		{
+			double seconds = 0;
+			long max_rss_kb = 0; // 0 when unknown
+		};
+
+		struct Entry
+		{
+			double seconds = 0;
+			long max_rss_kb = 0;
+
+			// Previous runs, oldest first
+			std::vector<Sample> history{};
+		};
+
+		std::filesystem::path path = ".make.log";
+		std::map<std::string, Entry, std::less<>> entries{};
+
+		// Number of previous runs kept for each key
+		std::size_t history_size = 20;
+
+		// Keys recorded since log was loaded, that is ones built by this invocation
+		std::set<std::string, std::less<>> updated{};
+
+		static Build_Log load(std::filesystem::path path = ".make.log")
+		{
+			Build_Log log{ .path = path };
+			std::ifstream file(path);
+			for (std::string line; std::getline(file, line); ) {
+				// Format: <samples> <key>, where samples are <seconds>[,<max rss kb>] separated by ';', latest last
+				auto const space = line.find(' ');
+				if (space == std::string::npos) continue;
+				try {
+					std::vector<Sample> samples;
+					for (auto sample : std::string_view(line).substr(0, space) | std::views::split(';')) {
+						std::string const text(sample.begin(), sample.end());
+						auto const comma = text.find(',');
+						samples.push_back({
+							.seconds = std::stod(text.substr(0, comma)),
+							.max_rss_kb = comma == std::string::npos ? 0 : std::stol(text.substr(comma + 1)),
+						});
+					}
+					if (samples.empty()) continue;
+					auto &entry = log.entries[line.substr(space + 1)];
+					entry.seconds = samples.back().seconds;
+					entry.max_rss_kb = samples.back().max_rss_kb;
+					samples.pop_back();
+					entry.history = std::move(samples);
+				} catch (std::exception const&) {
+					// Skip corrupted lines, log is only a hint
+				}
+			}
+			return log;
+		}
+
+		// Writes log to temporary file renamed over the old one, so interrupted save doesn't lose it
+		void save() const
+		{
+			auto temporary = path;
+			temporary += ".tmp";
+			std::ofstream file(temporary, std::ios::trunc);
+			auto const write = [&](Sample sample) {
+				file << sample.seconds;
+				if (sample.max_rss_kb) file << ',' << sample.max_rss_kb;
+			};
+			for (auto const& [key, entry] : entries) {
+				for (auto sample : entry.history) {
+					write(sample);
+					file << ';';
+				}
+				write({ entry.seconds, entry.max_rss_kb });
+				file << ' ' << key << '\n';
+			}
+			file.close();
+			std::error_code ec;
+			std::filesystem::rename(temporary, path, ec);
+		}
+
+		std::optional<double> seconds(std::string_view key) const
+		{
+			if (auto it = entries.find(key); it != entries.end()) {
+				return it->second.seconds;
+			}
+			return std::nullopt;
+		}
+
+		void record(std::string key, double seconds, long max_rss_kb = 0)
+		{
+			auto [it, inserted] = entries.try_emplace(key);
+			auto &entry = it->second;
+			if (!inserted && !updated.contains(key)) {
+				entry.history.push_back({ entry.seconds, entry.max_rss_kb });
+				if (entry.history.size() > history_size) {
+					entry.history.erase(entry.history.begin(), entry.history.end() - history_size);
+				}
+			}
+			entry.seconds = seconds;
+			entry.max_rss_kb = max_rss_kb;
+			updated.insert(std::move(key));
+		}
+	};
+
+	namespace details
+	{
+		inline void json_append(std::string &out, std::string_view value)
+		{
+			out += '"';
+			for (unsigned char c : value) {
+				switch (c) {
+				break; case '"':  out += "\\\"";
+				break; case '\\': out += "\\\\";
+				break; case '\n': out += "\\n";
+				break; case '\t': out += "\\t";
+				break; default:
+					if (c < 0x20) {
+						char escaped[8];
+						std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+						out += escaped;
+					} else {
+						out += char(c);
+					}
+				}
+			}
+			out += '"';
+		}
+
+		inline void json_append(std::string &out, std::vector<std::string> const& values)
+		{
+			out += '[';
+			for (auto const& value : values) {
+				if (&value != values.data()) out += ',';
+				json_append(out, value);
+			}
+			out += ']';
+		}
+
+		inline void json_append(std::string &out, double value)
+		{
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+			out += buffer;
+		}
+
+		inline void json_append(std::string &out, long long value)
+		{
+			out += std::to_string(value);
+		}
+	}
+
+	// Newline delimited JSON events of executor, for tools following build live:
+	//   {"event":"queued","time":0,"id":3,"name":"main.o","argv":["g++",...]}
+	//   {"event":"started","time":0.1,"id":3,"pid":1234,"cache":"miss","argv":[...]}
+	//   {"event":"finished","time":1.4,"id":3,"cache":"miss","exit_code":0,"seconds":1.3,"user_seconds":1.2,"system_seconds":0.1,"max_rss_kb":81234}
+	//   {"event":"finished","time":0.1,"id":4,"cache":"hit","exit_code":0,"seconds":0}
+	//   {"event":"skipped","time":1.4,"id":5}  (job depending on failed one)
+	// Failures by signal have "signal" instead of "exit_code". Time is in seconds since stream creation.
+	// Events are written by logger's writer thread, so slow consumer doesn't stall the build.
+	struct Event_Stream
+	{
+		int fd = -1;
+		Clock::time_point start = Clock::now();
+
+		// Creates (or truncates) file for events, it stays open for the lifetime of build script
+		static Event_Stream open(std::filesystem::path const& path)
+		{
+			if (path.has_parent_path()) {
+				std::filesystem::create_directories(path.parent_path());
+			}
+			int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			panic_if(fd < 0, "Failed to open " + path.string() + ": " + strerror(errno));
+			return { .fd = fd };
+		}
+
+		// Starts event object with its kind and time, caller appends fields with field() and sends it with emit()
+		std::string event(std::string_view kind) const
+		{
+			std::string out = "{\"event\":";
+			details::json_append(out, kind);
+			field(out, "time", std::chrono::duration<double>(Clock::now() - start).count());
+			return out;
+		}
+
+		template<typename T>
+		static void field(std::string &out, std::string_view key, T const& value)
+		{
+			out += ',';
+			details::json_append(out, key);
+			out += ':';
+			if constexpr (std::is_integral_v<T>) {
+				details::json_append(out, (long long)value);
+			} else if constexpr (std::is_floating_point_v<T>) {
+				details::json_append(out, double(value));
+			} else {
+				details::json_append(out, value);
+			}
+		}
+
+		void emit(std::string out) const
+		{
+			out += "}\n";
+			logger.write(fd, out);
+		}
+	};
+
+	namespace details
+	{
+		// Formats duration for humans, like 45s, 3m07s or 1h20m
+		inline std::string format_seconds(double seconds)
+		{
+			auto const total = (long long)std::ceil(seconds);
+			char buffer[32];
+			if (total < 60) {
+				std::snprintf(buffer, sizeof(buffer), "%llds", total);
+			} else if (total < 3600) {
+				std::snprintf(buffer, sizeof(buffer), "%lldm%02llds", total / 60, total % 60);
+			} else {
+				std::snprintf(buffer, sizeof(buffer), "%lldh%02lldm", total / 3600, total / 60 % 60);
+			}
+			return buffer;
+		}
+
+		inline int pidfd_open(pid_t pid)
+		{
+			return ::syscall(SYS_pidfd_open, pid, 0);
+		}
+
+		// Reads whole file collecting output of job from the beginning and closes it
+		inline std::string take_captured(int fd)
+		{
+			std::string text;
+			char buffer[4096];
+			for (off_t offset = 0; ; ) {
+				auto const n = ::pread(fd, buffer, sizeof(buffer), offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) break;
+				text.append(buffer, n);
+				offset += n;
+			}
+			::close(fd);
+			return text;
+		}
+
+		// Cancellation of running executor, requested by Jobs::cancel or by signal handler.
+		// Pipe wakes up executor waiting for jobs.
+		inline volatile std::sig_atomic_t cancel_requested = 0;
+		inline volatile std::sig_atomic_t cancel_signal = 0;
+		inline int cancel_pipe[2] = { -1, -1 };
+
+		// Tasks running on their own threads report their (negative) pid and wait status through it
+		inline int task_pipe[2] = { -1, -1 };
+
+		// Async signal safe
+		inline void request_cancel()
+		{
+			cancel_requested = 1;
+			if (cancel_pipe[1] >= 0) {
+				[[maybe_unused]] auto _ = ::write(cancel_pipe[1], "", 1);
+			}
+		}
+
+		// Routes SIGINT and SIGTERM to cancellation for its lifetime
+		struct Cancellation_Scope
+		{
+			struct sigaction previous_interrupt{}, previous_terminate{};
+
+			Cancellation_Scope()
+			{
+				if (cancel_pipe[0] < 0) {
+					panic_if(::pipe2(cancel_pipe, O_CLOEXEC | O_NONBLOCK) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+				}
+				cancel_requested = 0;
+				cancel_signal = 0;
+
+				struct sigaction action{};
+				action.sa_handler = [](int signal) { cancel_signal = signal; request_cancel(); };
+				::sigemptyset(&action.sa_mask);
+				::sigaction(SIGINT, &action, &previous_interrupt);
+				::sigaction(SIGTERM, &action, &previous_terminate);
+			}
+
+			// Signal that cancelled the scope is raised again with previous handlers, so after executor cleaned up
+			// build script terminates (or handles it) like it would without the executor
+			~Cancellation_Scope()
+			{
+				::sigaction(SIGINT, &previous_interrupt, nullptr);
+				::sigaction(SIGTERM, &previous_terminate, nullptr);
+				if (cancel_signal) {
+					logger.flush();
+					::raise(std::exchange(cancel_signal, 0));
+				}
+			}
+
+			Cancellation_Scope(Cancellation_Scope const&) = delete;
+			Cancellation_Scope& operator=(Cancellation_Scope const&) = delete;
+		};
+	}
+
+	namespace details
+	{
+		// Rewrites paths of given outputs passed to -o (as separate argument or joined with it) to temporary
+		// ones next to them, keeping extension. Returns pairs of output and temporary path.
+		// Commands are left alone when compiler names other files after -o: renaming those along wouldn't
+		// fix references to temporary name (like skeleton unit naming .dwo or target of dependency file).
+		inline std::vector<std::pair<std::filesystem::path, std::filesystem::path>> redirect_outputs(
+			Cmd &cmd,
+			std::vector<std::filesystem::path> const& outputs)
+		{
+			auto const has = [&](std::string_view flag) { return std::ranges::find(cmd.argv, flag) != cmd.argv.end(); };
+			bool const dependency_file_named_after_output = (has("-MD") || has("-MMD")) && !(has("-MF") && has("-MT"));
+			if (has("-gsplit-dwarf") || has("-ftime-trace") || has("-save-temps=obj") || dependency_file_named_after_output) {
+				return {};
+			}
+
+			auto const absolute = [&](std::filesystem::path const& path) {
+				return std::filesystem::absolute(cmd.cwd.empty() ? path : cmd.cwd / path).lexically_normal();
+			};
+
+			std::vector<std::pair<std::filesystem::path, std::filesystem::path>> redirected;
+			auto const redirect = [&](std::string &arg) {
+				std::filesystem::path const path = arg;
+				auto const output = std::ranges::find_if(outputs, [&](auto const& output) {
+					return std::filesystem::absolute(output).lexically_normal() == absolute(path);
+				});
+				if (output == outputs.end()) return;
+
+				auto temporary = path;
+				temporary.replace_filename(path.stem().string() + ".tmp" + path.extension().string());
+				redirected.emplace_back(*output, absolute(temporary));
+				arg = temporary.string();
+			};
+
+			for (auto it = cmd.argv.begin(); it != cmd.argv.end(); ++it) {
+				if (*it == "-o" && it + 1 != cmd.argv.end()) {
+					redirect(*++it);
+				} else if (it->starts_with("-o") && it->size() > 2) {
+					auto path = it->substr(2);
+					redirect(path);
+					*it = "-o" + path;
+				}
+			}
+			return redirected;
+		}
+	}
+
+	// Executes commands in parallel, respecting dependencies between them.
+	struct Jobs
+	{
+		using Id = std::size_t;
+
+		struct Result
+		{
+			Status status;
+			double seconds;
+			details::Usage usage = {};
+		};
+
+		struct Job
+		{
+			// Key under which duration is recorded in build log; when empty duration is not recorded
+			std::string name{};
+
+			Cmd cmd{};
+
+			// Jobs that must successfully finish before this one starts
+			std::vector<Id> after{};
+
+			// Called right before starting, when jobs it depends on already finished, so it may prepare
+			// command from their results. Returning false marks job as up to date without running it.
+			std::function<bool(Job&)> on_start{};
+
+			// Called after process finished. Jobs added from inside of it are awaited by
+			// dependents of this job too, which allows retrying or splitting work. Dependents
+			// that declare inputs await only added jobs with some of them among outputs.
+			std::function<void(Result const&)> on_finish{};
+
+			// Failure is handled by on_finish (e.g. by scheduling retry) and doesn't fail the build
+			bool fallible = false;
+
+			// Number of parallelism slots taken, for jobs that run several threads or processes themselves
+			unsigned weight = 1;
+
+			// When not empty, standard output and error of the job are written to this file
+			std::filesystem::path output{};
+
+			// Seconds after which job is terminated, 0 means no limit
+			double timeout = 0;
+
+			// Files read by the job, used by Order::Recently_Edited_First and for awaiting jobs added by on_finish
+			std::vector<std::filesystem::path> inputs{};
+
+			// Files produced by the job. When it fails or is interrupted they are removed,
+			// so partially written files aren't taken as up to date by the next run.
+			std::vector<std::filesystem::path> outputs{};
+
+			// Work done by build script itself instead of running cmd, returning exit code. It runs on its
+			// own thread, so it doesn't hold off starting other jobs, and it can't be terminated.
+			std::function<int()> task{};
+		};
+
+		std::vector<Job> jobs{};
+
+		// Status of each finished job, std::nullopt when job was not run
+		std::vector<std::optional<Status>> statuses{};
+
+		Build_Log *log = nullptr;
+
+		// When set, receives events of jobs as they are added, started and finished
+		Event_Stream *events = nullptr;
+
+		unsigned parallelism = std::max(1u, std::thread::hardware_concurrency());
+
+		// Seconds between SIGTERM and SIGKILL sent to terminated job
+		double kill_grace = 5.0;
+
+		enum class On_Failure
+		{
+			Stop,       // don't start new jobs, wait for running ones
+			Fail_Fast,  // terminate running jobs immediately
+			Keep_Going, // run everything that doesn't depend on failed jobs, report all failures at the end
+		};
+
+		On_Failure on_failure = On_Failure::Stop;
+
+		enum class Order
+		{
+			Added,                 // start ready jobs in order they were added
+			Recently_Edited_First, // start ones with most recently modified inputs first, so errors in files
+			                       // developer just edited show up before unrelated jobs finish
+		};
+
+		Order order = Order::Added;
+
+		// Includes of job inputs. With Recently_Edited_First, edits of headers count for inputs including them.
+		Dependency_Graph const* includes = nullptr;
+
+		// Jobs write declared outputs passed with -o to temporary files, renamed in place only when job succeeds,
+		// so crash or power loss never leaves half written file with name of the output. Temporary file keeps
+		// extension of the output (foo.o is written as foo.tmp.o). Commands where compiler names other files
+		// after -o (-gsplit-dwarf, -ftime-trace, -save-temps=obj, -MD without -MF and -MT) write outputs directly.
+		bool atomic_outputs = false;
+
+		// Called when run stops early (cancelled by cancel(), SIGINT or SIGTERM, Fail_Fast failure or panic),
+		// after jobs were stopped, their partial outputs removed and build log saved. Persist other state
+		// here (like dependency graph), so the next run resumes where this one stopped.
+		std::function<void()> on_interrupt{};
+
+		// Minimal seconds between updates of progress shown on terminal
+		double progress_interval = 0.1;
+
+		// Output of jobs without Job::output is collected and printed when they finish, so outputs of parallel
+		// jobs don't interleave and terminal shows running commands in status line. Disable for jobs that
+		// need terminal, compilers also don't color diagnostics written to a file.
+		bool capture_output = true;
+
+		Id add(Job job)
+		{
+			jobs.push_back(std::move(job));
+			if (events) {
+				auto event = events->event("queued");
+				events->field(event, "id", jobs.size() - 1);
+				events->field(event, "name", jobs.back().name);
+				events->field(event, "argv", jobs.back().cmd.argv);
+				events->emit(std::move(event));
+			}
+			return jobs.size() - 1;
+		}
+
+		// Runs all added jobs, including ones added while running. Reaction to failed job is
+		// selected by on_failure. Jobs run in their own process
+		// groups; ones exceeding their timeout, or all of them after cancellation (also requested
+		// by SIGINT or SIGTERM), get SIGTERM followed by SIGKILL after kill_grace seconds.
+		// Returns true if all succeeded.
+		bool run()
+		{
+			enum State { Waiting, Running, Done, Failed };
+			std::vector<State> state;
+			std::map<pid_t, Running_Job> running;
+			unsigned busy = 0;
+
+			// Ids in order in which ready jobs are started, and latest modification of their inputs
+			std::vector<Id> queue;
+			std::vector<std::filesystem::file_time_type> edited;
+			std::optional<std::vector<std::filesystem::file_time_type>> latest_edits;
+			// Threads of tasks, identified by negative pids
+			std::vector<std::thread> tasks;
+			bool failed = false;
+			bool cancelled = false;
+			std::vector<Id> failures;
+
+			details::Cancellation_Scope const cancellation;
+
+			auto const remove_outputs = [&](Id id) {
+				for (auto const& output : jobs[id].outputs) {
+					std::error_code ec;
+					std::filesystem::remove(output, ec);
+				}
+			};
+
+			// Panic in a callback shouldn't leave jobs running and completed work unrecorded
+			struct Panic_Scope
+			{
+				std::function<void()> previous;
+				~Panic_Scope() { details::on_panic = std::move(previous); }
+			} const panic_scope { std::exchange(details::on_panic, [&] {
+				for (auto const& [pid, job] : running) {
+					if (pid > 0) details::kill_group(pid, SIGKILL);
+					remove_outputs(job.id);
+					for (auto const& [_, temporary] : job.temporary_outputs) {
+						std::error_code ec;
+						std::filesystem::remove(temporary, ec);
+					}
+				}
+				if (log) log->save();
+				if (on_interrupt) on_interrupt();
+			}) };
+
+			// Jobs heavier than whole executor run alone
+			auto const weight = [&](Id id) { return std::clamp(jobs[id].weight, 1u, std::max(1u, parallelism)); };
+
+			// Durations of jobs finished in this run, estimate jobs without history
+			double finished_seconds = 0;
+			std::size_t finished_count = 0;
+
+			std::optional<Clock::time_point> next_progress;
+			auto const report_progress = [&](bool force) {
+				auto const now = Clock::now();
+				if (!logger.tty || (!force && next_progress && now < *next_progress)) {
+					return;
+				}
+				next_progress = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(progress_interval));
+
+				std::vector<std::optional<double>> expected(jobs.size());
+				double known_seconds = 0;
+				std::size_t known_count = 0;
+				for (Id id = 0; id < jobs.size(); ++id) {
+					if (log && !jobs[id].name.empty() && (expected[id] = log->seconds(jobs[id].name))) {
+						known_seconds += *expected[id];
+						++known_count;
+					}
+				}
+				known_seconds += finished_seconds;
+				known_count += finished_count;
+
+				auto const done = std::ranges::count_if(state, [](State s) { return s == Done || s == Failed; });
+				auto text = "[" + std::to_string(done) + "/" + std::to_string(jobs.size()) + "]";
+				if (known_count == 0) {
+					logger.progress(text);
+					return;
+				}
+
+				// Time left for each job, running ones already spent part of it
+				std::vector<double> left(jobs.size());
+				for (Id id = 0; id < jobs.size(); ++id) {
+					if (state[id] == Waiting) {
+						left[id] = expected[id].value_or(known_seconds / known_count);
+					}
+				}
+				for (auto const& [_, job] : running) {
+					auto const elapsed = std::chrono::duration<double>(now - job.start).count();
+					left[job.id] = std::max(0.0, expected[job.id].value_or(known_seconds / known_count) - elapsed);
+				}
+
+				// Build can't finish before longest chain of dependent jobs, nor before all work is spread over slots
+				std::vector<double> chain(jobs.size(), -1);
+				std::function<double(Id)> longest = [&](Id id) {
+					if (chain[id] < 0) {
+						chain[id] = 0;
+						double before = 0;
+						for (Id dep : jobs[id].after) before = std::max(before, longest(dep));
+						chain[id] = before + left[id];
+					}
+					return chain[id];
+				};
+				double critical = 0, work = 0;
+				for (Id id = 0; id < jobs.size(); ++id) {
+					critical = std::max(critical, longest(id));
+					work += left[id] * weight(id);
+				}
+
+				logger.progress(text + " ETA " + details::format_seconds(std::max(critical, work / std::max(1u, parallelism))));
+			};
+
+			for (;;) {
+				state.resize(jobs.size(), Waiting);
+				statuses.resize(jobs.size());
+
+				if (details::cancel_requested && !cancelled) {
+					cancelled = true;
+					for (auto &[pid, job] : running) terminate(pid, job);
+				}
+
+				if (queue.size() != jobs.size()) {
+					auto const added_from = queue.size();
+					queue.resize(jobs.size());
+					std::iota(queue.begin() + added_from, queue.end(), added_from);
+					if (order == Order::Recently_Edited_First) {
+						edited.resize(jobs.size(), std::filesystem::file_time_type::min());
+						for (Id id = added_from; id < jobs.size(); ++id) {
+							for (auto const& input : jobs[id].inputs) {
+								// Graph is named by canonical paths, like includes_in_directory and resolve return them
+								std::error_code ec;
+								auto const node = includes ? includes->find(std::filesystem::weakly_canonical(input, ec).string()) : std::nullopt;
+								if (node) {
+									if (!latest_edits) latest_edits = make::latest_edits(*includes);
+									edited[id] = std::max(edited[id], (*latest_edits)[*node]);
+									continue;
+								}
+								if (auto const time = std::filesystem::last_write_time(input, ec); !ec) {
+									edited[id] = std::max(edited[id], time);
+								}
+							}
+						}
+						std::ranges::stable_sort(queue, std::greater{}, [&](Id id) { return edited[id]; });
+					}
+				}
+
+				bool const may_start = !cancelled && (!failed || on_failure == On_Failure::Keep_Going);
+				for (std::size_t i = 0; may_start && i < queue.size() && busy < parallelism; ++i) {
+					Id const id = queue[i];
+					if (state[id] != Waiting) continue;
+
+					auto const& after = jobs[id].after;
+					if (std::ranges::any_of(after, [&](Id dep) { return state[dep] == Failed; })) {
+						state[id] = Failed;
+						if (events) {
+							auto event = events->event("skipped");
+							events->field(event, "id", id);
+							events->emit(std::move(event));
+						}
+						continue;
+					}
+					if (!std::ranges::all_of(after, [&](Id dep) { return state[dep] == Done; })) {
+						continue;
+					}
+					if (busy + weight(id) > std::max(1u, parallelism)) {
+						continue;
+					}
+
+					if (auto on_start = jobs[id].on_start; on_start && !on_start(jobs[id])) {
+						statuses[id] = Status{};
+						state[id] = Done;
+						if (events) {
+							auto event = events->event("finished");
+							events->field(event, "id", id);
+							events->field(event, "cache", "hit");
+							events->field(event, "exit_code", 0);
+							events->field(event, "seconds", 0);
+							events->emit(std::move(event));
+						}
+						continue;
+					}
+
+					if (auto const& task = jobs[id].task) {
+						if (details::task_pipe[0] < 0) {
+							panic_if(::pipe2(details::task_pipe, O_CLOEXEC | O_NONBLOCK) < 0, std::string("Failed to create pipe: ") + strerror(errno));
+						}
+						logger.command("[TASK] " + (jobs[id].name.empty() ? std::to_string(id) : jobs[id].name));
+						pid_t const pid = -pid_t(tasks.size() + 1);
+						tasks.emplace_back([task, pid] {
+							std::pair<pid_t, int> const finished = { pid, W_EXITCODE(task() & 0xff, 0) };
+							[[maybe_unused]] auto _ = ::write(details::task_pipe[1], &finished, sizeof(finished));
+						});
+						running.emplace(pid, Running_Job { .id = id, .start = Clock::now() });
+						state[id] = Running;
+						busy += weight(id);
+
+						if (events) {
+							auto event = events->event("started");
+							events->field(event, "id", id);
+							events->field(event, "cache", "miss");
+							events->emit(std::move(event));
+						}
+						continue;
+					}
+
+					auto stdio = inherited_stdio;
+					if (auto const& output = jobs[id].output; !output.empty()) {
+						if (output.has_parent_path()) {
+							std::filesystem::create_directories(output.parent_path());
+						}
+						int const fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+						panic_if(fd < 0, "Failed to open " + output.string() + ": " + strerror(errno));
+						stdio[STDOUT_FILENO] = stdio[STDERR_FILENO] = fd;
+					}
+
+					std::array<int, 2> captured = { -1, -1 };
+					if (jobs[id].output.empty() && capture_output) {
+						for (auto &fd : captured) {
+							fd = ::memfd_create("make-output", MFD_CLOEXEC);
+							panic_if(fd < 0, std::string("Failed to create file for output of job: ") + strerror(errno));
+						}
+						stdio[STDOUT_FILENO] = captured[0];
+						stdio[STDERR_FILENO] = captured[1];
+					}
+
+					std::vector<std::pair<std::filesystem::path, std::filesystem::path>> temporary_outputs;
+					pid_t pid;
+					if (atomic_outputs && !jobs[id].outputs.empty()) {
+						auto cmd = jobs[id].cmd;
+						temporary_outputs = details::redirect_outputs(cmd, jobs[id].outputs);
+						pid = cmd.spawn(stdio, true);
+					} else {
+						pid = jobs[id].cmd.spawn(stdio, true);
+					}
+					if (!jobs[id].output.empty()) {
+						::close(stdio[STDOUT_FILENO]);
+					}
+
+					Running_Job job {
+						.id = id,
+						.start = Clock::now(),
+						// Server may have reaped the child already, then pidfd could refer to another process.
+						// Exits are reported by server anyway.
+						.pidfd = details::spawn_server.socket >= 0 ? -1 : details::pidfd_open(pid),
+						.temporary_outputs = std::move(temporary_outputs),
+						.captured = captured,
+					};
+					if (jobs[id].timeout > 0) {
+						job.deadline = job.start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(jobs[id].timeout));
+					}
+					running.emplace(pid, job);
+					state[id] = Running;
+					busy += weight(id);
+
+					if (events) {
+						auto event = events->event("started");
+						events->field(event, "id", id);
+						events->field(event, "pid", pid);
+						events->field(event, "cache", "miss");
+						events->field(event, "argv", jobs[id].cmd.argv);
+						events->emit(std::move(event));
+					}
+				}
+
+				if (running.empty()) {
+					break;
+				}
+
+				report_progress(false);
+				auto const finished = wait_for_events(running, next_progress);
+				for (auto const& [pid, wstatus] : finished) {
+					auto const it = running.find(pid);
+					auto const status = status_from_wait(wstatus);
+					if (it == running.end() || !status) {
+						continue;
+					}
+
+					auto const job = it->second;
+					auto const id = job.id;
+					running.erase(it);
+					busy -= weight(id);
+					if (job.pidfd >= 0) {
+						::close(job.pidfd);
+					}
+
+					Result result {
+						.status = *status,
+						.seconds = std::chrono::duration<double>(Clock::now() - job.start).count(),
+					};
+					if (auto usage = details::child_usage.extract(pid)) {
+						result.usage = usage.mapped();
+					}
+
+					if (job.captured[0] >= 0) {
+						auto const out = details::take_captured(job.captured[0]);
+						auto const err = details::take_captured(job.captured[1]);
+						// Failure handled by on_finish reports its errors again (like retry does), if at all
+						if (result.status || !jobs[id].fallible || job.terminated) {
+							if (!out.empty()) logger.write(STDOUT_FILENO, out);
+							if (!err.empty()) logger.write(STDERR_FILENO, err);
+						}
+					}
+
+					if (events) {
+						auto event = events->event("finished");
+						events->field(event, "id", id);
+						events->field(event, "cache", "miss");
+						switch (result.status.kind) {
+						break; case Status::EXIT:   events->field(event, "exit_code", result.status.exit_code);
+						break; case Status::SIGNAL: events->field(event, "signal", result.status.signal);
+						}
+						events->field(event, "seconds", result.seconds);
+						events->field(event, "user_seconds", result.usage.user_seconds);
+						events->field(event, "system_seconds", result.usage.system_seconds);
+						events->field(event, "max_rss_kb", result.usage.max_rss_kb);
+						events->emit(std::move(event));
+					}
+
+					statuses[id] = result.status;
+					state[id] = result.status || (jobs[id].fallible && !job.terminated) ? Done : Failed;
+					for (auto const& [output, temporary] : job.temporary_outputs) {
+						std::error_code ec;
+						if (result.status && std::filesystem::exists(temporary, ec)) {
+							std::filesystem::rename(temporary, output);
+						} else {
+							std::filesystem::remove(temporary, ec);
+						}
+					}
+					if (!result.status) {
+						remove_outputs(id);
+					}
+
+					if (!result.status) {
+						auto message = "[FAIL] " + (jobs[id].name.empty() ? cmd_render(jobs[id].cmd.argv) : jobs[id].name);
+						switch (result.status.kind) {
+						break; case Status::EXIT:   message += " (exit_code = " + std::to_string(result.status.exit_code) + ")";
+						break; case Status::SIGNAL: message += std::string(" (signal: ") + strsignal(result.status.signal) + ")";
+						}
+						// Failure handled by on_finish (like retry) isn't failure of the build
+						if (!jobs[id].fallible || job.terminated) {
+							logger.print(Logger::Level::Error, message);
+						}
+						if (state[id] == Failed) {
+							failed = true;
+							failures.push_back(id);
+							if (on_failure == On_Failure::Fail_Fast && !cancelled) {
+								cancelled = true;
+								for (auto &[pid, job] : running) {
+									// Ones reaped together with this job finish in following iterations
+									if (std::ranges::find(finished, pid, &std::pair<pid_t, int>::first) == finished.end()) terminate(pid, job);
+								}
+								if (log) log->save();
+								logger.flush();
+							}
+						}
+					} else {
+						finished_seconds += result.seconds;
+						++finished_count;
+						if (log && !jobs[id].name.empty()) {
+							log->record(jobs[id].name, result.seconds, result.usage.max_rss_kb);
+						}
+					}
+
+					if (auto on_finish = jobs[id].on_finish) {
+						auto const added_from = jobs.size();
+						on_finish(result);
+						auto const normal = [](std::filesystem::path const& path) { return std::filesystem::absolute(path).lexically_normal(); };
+						for (Id waiting = 0; waiting < added_from; ++waiting) {
+							if (state[waiting] != Waiting || std::ranges::find(jobs[waiting].after, id) == jobs[waiting].after.end()) {
+								continue;
+							}
+							// Dependent declaring its inputs waits only for added jobs producing some of them
+							std::set<std::filesystem::path> inputs;
+							for (auto const& input : jobs[waiting].inputs) inputs.insert(normal(input));
+							for (Id added = added_from; added < jobs.size(); ++added) {
+								if (inputs.empty() || std::ranges::any_of(jobs[added].outputs, [&](auto const& output) { return inputs.contains(normal(output)); })) {
+									jobs[waiting].after.push_back(added);
+								}
+							}
+						}
+					}
+				}
+			}
+
+			// Every task reported finishing already
+			for (auto &task : tasks) task.join();
+
+			report_progress(true);
+			// Output following the run shouldn't be appended to last status
+			logger.progress("");
+			logger.status("");
+			logger.flush();
+
+			if (cancelled) {
+				if (log) log->save();
+				if (on_interrupt) on_interrupt();
+			}
+
+			if (on_failure == On_Failure::Keep_Going && !failures.empty()) {
+				auto const not_run = std::ranges::count_if(statuses, [](auto const& status) { return !status; });
+				auto summary = "[FAIL] " + std::to_string(failures.size()) + " job(s) failed, " + std::to_string(not_run) + " not run because of them:";
+				for (auto id : failures) {
+					summary += "\n  " + (jobs[id].name.empty() ? cmd_render(jobs[id].cmd.argv) : jobs[id].name);
+				}
+				logger.print(Logger::Level::Error, summary);
+			}
+
+			return !failed && !cancelled && std::ranges::all_of(state, [](State s) { return s == Done; });
+		}
+
+		// Requests termination of running jobs and stops starting new ones.
+		// May be called from on_finish callbacks; SIGINT and SIGTERM do the same while jobs run.
+		void cancel()
+		{
+			details::request_cancel();
+		}
+
+		struct Running_Job
+		{
+			Id id;
+			Clock::time_point start;
+			int pidfd = -1;
+
+			// When next termination signal should be sent
+			std::optional<Clock::time_point> deadline{};
+			int next_signal = SIGTERM;
+			bool terminated = false;
+
+			// Declared outputs and temporary paths job writes them to, with atomic_outputs
+			std::vector<std::pair<std::filesystem::path, std::filesystem::path>> temporary_outputs{};
+
+			// Files collecting standard output and error, with capture_output
+			std::array<int, 2> captured = { -1, -1 };
+		};
+
+		// Sends next signal of SIGTERM, SIGKILL sequence to process group of the job
+		void terminate(pid_t pid, Running_Job &job)
+		{
+			if (job.next_signal == 0) {
+				return;
+			}
+			if (pid < 0) {
+				// Task running inside of build script can only be waited for
+				job.deadline = std::nullopt;
+				return;
+			}
+
+			logger.print(Logger::Level::Warning, "[KILL] " + (jobs[job.id].name.empty() ? cmd_render(jobs[job.id].cmd.argv) : jobs[job.id].name)
+				+ " (" + strsignal(job.next_signal) + ")");
+
+			details::kill_group(pid, job.next_signal);
+
+			job.terminated = true;
+			if (job.next_signal == SIGTERM) {
+				job.next_signal = SIGKILL;
+				job.deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(kill_grace));
+			} else {
+				job.next_signal = 0;
+				job.deadline = std::nullopt;
+			}
+		}
+
+		// Waits until some jobs finished, their deadline passed, cancellation was requested
+		// or wake up time passed. Returns pids and wait statuses of finished processes.
+		std::vector<std::pair<pid_t, int>> wait_for_events(std::map<pid_t, Running_Job> &running, std::optional<Clock::time_point> wake_up = std::nullopt)
+		{
+			auto &server = details::spawn_server;
+			std::vector<std::pair<pid_t, int>> finished;
+
+			for (auto it = server.exited.begin(); it != server.exited.end(); ) {
+				if (running.contains(it->first)) {
+					finished.emplace_back(it->first, it->second);
+					it = server.exited.erase(it);
+				} else {
+					++it;
+				}
+			}
+			if (!finished.empty()) {
+				return finished;
+			}
+
+			std::vector<pollfd> fds = {
+				{ .fd = details::cancel_pipe[0], .events = POLLIN, .revents = 0 },
+				{ .fd = details::task_pipe[0], .events = POLLIN, .revents = 0 },
+			};
+			bool all_pollable = true;
+			if (server.socket >= 0) {
+				fds.push_back({ .fd = server.socket, .events = POLLIN, .revents = 0 });
+			} else {
+				for (auto const& [pid, job] : running) {
+					if (pid < 0) continue;
+					fds.push_back({ .fd = job.pidfd, .events = POLLIN, .revents = 0 });
+					all_pollable &= job.pidfd >= 0;
+				}
+			}
+
+			// Without pidfds processes must be checked periodically
+			auto const now = Clock::now();
+			long long timeout = all_pollable ? -1 : 50;
+			auto const wait_until = [&](Clock::time_point deadline) {
+				auto const left = std::max(0ll, (long long)std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
+				timeout = timeout < 0 ? left : std::min(timeout, left);
+			};
+			for (auto const& [_, job] : running) {
+				if (job.deadline) wait_until(*job.deadline);
+			}
+			if (wake_up) wait_until(*wake_up);
+
+			if (::poll(fds.data(), fds.size(), int(std::min<long long>(timeout, std::numeric_limits<int>::max()))) < 0 && errno != EINTR) {
+				panic(std::string("Failed to wait for jobs: ") + strerror(errno));
+			}
+
+			for (char drain[64]; ::read(details::cancel_pipe[0], drain, sizeof(drain)) > 0; ) {}
+
+			if (details::task_pipe[0] >= 0) {
+				for (std::pair<pid_t, int> task; ::read(details::task_pipe[0], &task, sizeof(task)) == sizeof(task); ) {
+					finished.push_back(task);
+				}
+			}
+
+			if (server.socket >= 0) {
+				if (fds[2].revents & (POLLIN | POLLHUP)) {
+					finished.push_back(details::wait_next());
+				}
+			} else {
+				for (auto const& [pid, _] : running) {
+					if (pid < 0) continue;
+					int wstatus = 0;
+					rusage usage;
+					if (::wait4(pid, &wstatus, WNOHANG, &usage) == pid) {
+						details::child_usage[pid] = details::usage_from_rusage(usage);
+						finished.emplace_back(pid, wstatus);
+					}
+				}
+			}
+
+			for (auto &[pid, job] : running) {
+				// Reaped leader's pid may be reused already
+				if (std::ranges::find(finished, pid, &std::pair<pid_t, int>::first) != finished.end()) continue;
+				if (job.deadline && *job.deadline <= Clock::now()) {
+					if (job.next_signal == SIGTERM) {
+						std::ostringstream message;
+						message << "[TIMEOUT] " << (jobs[job.id].name.empty() ? cmd_render(jobs[job.id].cmd.argv) : jobs[job.id].name)
+							<< " exceeded " << jobs[job.id].timeout << "s";
+						logger.print(Logger::Level::Error, message.str());
+					}
+					terminate(pid, job);
+				}
+			}
+
+			return finished;
+		}
+	};
+
+	// Source file compiled into object file
+	struct Compile_Unit
+	{
+		std::filesystem::path source;
+		std::filesystem::path object;
+	};
+
+	struct Batch_Options
+	{
+		// Bounds of estimated duration of single compiler invocation
+		double min_seconds = 0.2;
+		double max_seconds = 1.0;
+
+		// Upper bound of source files passed to single compiler invocation
+		std::size_t max_units = 32;
+
+		// Estimated duration of units not found in build log
+		double unknown_seconds = 0.25;
+	};
+
+	// Groups units into batches compiled by single compiler invocation. Batch size is chosen from
+	// durations recorded in build log, so that each worker still gets a few batches (for load
+	// balancing) while staying within [min_seconds, max_seconds]. Units in single batch have distinct file names,
+	// since compiler names objects after sources.
+	std::vector<std::vector<Compile_Unit>> batch_compile_units(
+		std::vector<Compile_Unit> const& units,
+		Build_Log const* log,
+		unsigned parallelism,
+		Batch_Options const& options = {})
+	{
+		auto const estimate = [&](Compile_Unit const& unit) {
+			auto const recorded = log ? log->seconds(unit.object.string()) : std::nullopt;
+			return recorded.value_or(options.unknown_seconds);
+		};
+
+		double total = 0;
+		for (auto const& unit : units) total += estimate(unit);
+		double const budget = std::clamp(total / (4.0 * std::max(1u, parallelism)), options.min_seconds, options.max_seconds);
+
+		std::vector<std::vector<Compile_Unit>> batches;
+		double current = 0;
+		for (auto const& unit : units) {
+			auto const seconds = estimate(unit);
+			bool const fits = !batches.empty()
+				&& current + seconds <= budget
+				&& batches.back().size() < options.max_units
+				&& std::ranges::none_of(batches.back(), [&](Compile_Unit const& other) {
+					return other.source.stem() == unit.source.stem();
+				});
+
+			if (!fits) {
+				batches.emplace_back();
+				current = 0;
+			}
+			batches.back().push_back(unit);
+			current += seconds;
+		}
+		return batches;
+	}
+
+	namespace details
+	{
+		// Makes paths in common compiler options absolute, so command can be executed in other directory
+		inline std::vector<std::string> absolute_path_flags(std::vector<std::string> const& argv, std::filesystem::path const& base)
+		{
+			static constexpr std::string_view path_flags[] = { "-I", "-isystem", "-iquote", "-idirafter", "-include" };
+
+			std::vector<std::string> result;
+			result.reserve(argv.size());
+			for (auto it = argv.begin(); it != argv.end(); ++it) {
+				result.push_back(*it);
+				for (auto flag : path_flags) {
+					if (*it == flag && std::next(it) != argv.end()) {
+						result.push_back((base / *++it).lexically_normal().string());
+						break;
+					}
+					if (flag == "-I" && it->starts_with(flag) && it->size() > flag.size()) {
+						result.back() = std::string(flag) + (base / it->substr(flag.size())).lexically_normal().string();
+						break;
+					}
+				}
+			}
+			return result;
+		}
+	}
+
+	// Schedules compilation of units with given compiler command (compiler with flags, without -c and -o),
+	// passing several sources to single compiler invocation to amortize compiler startup cost.
+	// Batched compiler runs in staging directory (.make/batch/N), from which objects are moved to their
+	// destination. When batch fails, its units are recompiled one by one to attribute errors to files.
+	// Returns ids of scheduled jobs.
+	std::vector<Jobs::Id> compile_batched(
+		Jobs &jobs,
+		Cmd const& compile,
+		std::vector<Compile_Unit> const& units,
+		Batch_Options const& options = {})
+	{
+		// Paths of units are relative to working directory of compile command, like its flags
+		auto const base = compile.cwd.empty() ? std::filesystem::current_path() : std::filesystem::absolute(compile.cwd);
+
+		auto const compile_single = [&jobs, compile, base](Compile_Unit const& unit) {
+			Cmd cmd = compile;
+			append(cmd, "-c", unit.source.string(), "-o", unit.object.string());
+			return jobs.add({
+				.name = unit.object.string(),
+				.cmd = std::move(cmd),
+				.inputs = { base / unit.source },
+				.outputs = { base / unit.object },
+			});
+		};
+
+		for (auto const& unit : units) {
+			if (unit.object.has_parent_path()) {
+				std::filesystem::create_directories((base / unit.object).parent_path());
+			}
+		}
+
+		std::vector<Jobs::Id> ids;
+		for (auto const& batch : batch_compile_units(units, jobs.log, jobs.parallelism, options)) {
+			if (batch.size() == 1) {
+				ids.push_back(compile_single(batch.front()));
+				continue;
+			}
+
+			static unsigned batch_count = 0;
+			auto staging = std::filesystem::absolute(".make/batch") / std::to_string(batch_count++);
+			std::filesystem::create_directories(staging);
+
+			Cmd cmd{details::absolute_path_flags(compile.argv, base), "-c"};
+			cmd.cwd = staging;
+			cmd.env = compile.env;
+			std::vector<std::filesystem::path> sources;
+			for (auto const& unit : batch) {
+				append(cmd, (base / unit.source).lexically_normal().string());
+				sources.push_back(base / unit.source);
+			}
+
+			ids.push_back(jobs.add({
+				.cmd = std::move(cmd),
+				.on_finish = [&jobs, batch, staging, base, compile_single](Jobs::Result const& result) {
+					for (auto const& unit : batch) {
+						auto compiled = staging / unit.source.filename().replace_extension(".o");
+						if (!result.status) {
+							std::filesystem::remove(compiled);
+							compile_single(unit);
+							continue;
+						}
+						std::filesystem::rename(compiled, base / unit.object);
+						if (jobs.log) {
+							jobs.log->record(unit.object.string(), result.seconds / batch.size());
+						}
+					}
+				},
+				.fallible = true,
+				.inputs = std::move(sources),
+			}));
+		}
+		return ids;
+	}
+
+	struct Archive_Options
+	{
+		std::string ar = "ar";
+
+		// Thin archive only references object files instead of copying them, which makes creating it
+		// about as cheap as writing symbol table. Not suitable for libraries distributed elsewhere.
+		bool thin = true;
+	};
+
+	// Schedules creation of static library from objects, after given jobs (usually ones producing
+	// objects) finished; unrelated jobs keep running in parallel. Existing library is updated only
+	// with objects newer than it and recreated when list of members changed since last successful
+	// run (kept in <library>.members).
+	Jobs::Id archive(
+		Jobs &jobs,
+		std::filesystem::path const& library,
+		std::vector<std::filesystem::path> const& objects,
+		std::vector<Jobs::Id> after = {},
+		Archive_Options const& options = {})
+	{
+		auto members_path = library;
+		members_path += ".members";
+
+		std::vector<std::string> members;
+		for (auto const& object : objects) {
+			members.push_back(object.string());
+		}
+
+		auto const save_members = [=] {
+			std::ofstream file(members_path);
+			for (auto const& member : members) file << member << '\n';
+		};
+
+		return jobs.add({
+			.name = library.string(),
+			.after = std::move(after),
+			.on_start = [=](Jobs::Job &job) {
+				std::vector<std::string> previous;
+				{
+					std::ifstream file(members_path);
+					for (std::string line; std::getline(file, line); ) previous.push_back(line);
+				}
+				// Until this job succeeds library may be in inconsistent state
+				std::filesystem::remove(members_path);
+
+				std::vector<std::string> changed;
+				if (previous == members && std::filesystem::exists(library)) {
+					auto const archived = std::filesystem::last_write_time(library);
+					std::ranges::copy_if(members, std::back_inserter(changed), [&](std::string const& object) {
+						return std::filesystem::last_write_time(object) > archived;
+					});
+					if (changed.empty()) {
+						save_members();
+						return false;
+					}
+				} else {
+					std::filesystem::remove(library);
+					if (library.has_parent_path()) {
+						std::filesystem::create_directories(library.parent_path());
+					}
+					changed = members;
+				}
+
+				job.cmd = Cmd{options.ar, options.thin ? "rcsT" : "rcs", library.string(), changed};
+				return true;
+			},
+			.on_finish = [=](Jobs::Result const& result) {
+				if (result.status) {
+					save_members();
+				}
+			},
+			.inputs = { objects.begin(), objects.end() },
+			.outputs = { library },
+		});
+	}
+
+	namespace compiler
+	{
+		inline namespace cpp
+		{
+			[[maybe_unused]] constexpr std::string_view gcc = "g++";
+			[[maybe_unused]] constexpr std::string_view clang = "clang++";
+			[[maybe_unused]] constexpr std::string_view posix = "c++";
+
+			constexpr std::string_view current()
+			{
+#if defined(__clang__)
+				return clang;
+#elif defined(__GNUC__)
+				return gcc;
+#else
+#error Unknown compiler
+#endif
+			}
+		}
+	}
+
+	namespace details
+	{
+		// Runs command with output discarded, used for probing the toolchain.
+		// Doesn't go through spawn server, since probes are rare and their status is awaited immediately.
+		inline Status run_quietly(std::vector<std::string> argv)
+		{
+			auto child_pid = ::fork();
+			if (child_pid < 0) {
+				panic(std::string("Failed to execute command: ") + strerror(errno));
+			}
+
+			if (child_pid == 0) {
+				if (int null = ::open("/dev/null", O_RDWR); null >= 0) {
+					::dup2(null, STDIN_FILENO);
+					::dup2(null, STDOUT_FILENO);
+					::dup2(null, STDERR_FILENO);
+				}
+				auto c_argv = std::make_unique<char*[]>(argv.size() + 1);
+				std::transform(argv.begin(), argv.end(), c_argv.get(), [](std::string &s) { return s.data(); });
+				::execvp(c_argv[0], c_argv.get());
+				::_exit(127);
+			}
+
+			for (;;) {
+				int wstatus = 0;
+				if (::waitpid(child_pid, &wstatus, 0) < 0) {
+					if (errno == EINTR) continue;
+					panic(std::string("Failed to wait for process: ") + strerror(errno));
+				}
+				if (auto status = status_from_wait(wstatus)) {
+					return *status;
+				}
+			}
+		}
+	}
+
+	namespace linker
+	{
+		[[maybe_unused]] constexpr std::string_view mold = "mold";
+		[[maybe_unused]] constexpr std::string_view lld  = "lld";
+		[[maybe_unused]] constexpr std::string_view gold = "gold";
+		[[maybe_unused]] constexpr std::string_view bfd  = "bfd";
+
+		// Linkers ordered from the fastest one
+		constexpr std::string_view by_speed[] = { mold, lld, gold, bfd };
+
+		// Whether linker can build .gdb_index section, which is required to make split DWARF fast to load by debugger
+		constexpr bool supports_gdb_index(std::string_view linker)
+		{
+			return linker == mold || linker == lld || linker == gold;
+		}
+
+		// Fastest linker that given compiler driver accepts in -fuse-ld, or empty string when none of known ones works.
+		// Each compiler is probed once, results are cached in .make/linkers between runs.
+		inline std::string fastest(std::vector<std::string> const& compiler)
+		{
+			static std::filesystem::path const cache_path = ".make/linkers";
+			static std::map<std::string, std::string> cache = [] {
+				// Format: <linker> <compiler>
+				std::map<std::string, std::string> cache;
+				std::ifstream file(cache_path);
+				for (std::string line; std::getline(file, line); ) {
+					auto const space = line.find(' ');
+					if (space != std::string::npos) {
+						cache[line.substr(space + 1)] = line.substr(0, space);
+					}
+				}
+				return cache;
+			}();
+
+			auto const key = cmd_render(compiler);
+			if (auto it = cache.find(key); it != cache.end()) {
+				return it->second == "-" ? std::string() : it->second;
+			}
+
+			std::string found;
+			for (auto linker : by_speed) {
+				auto probe = compiler;
+				append(probe, "-fuse-ld=" + std::string(linker), "-Wl,--version");
+				if (details::run_quietly(std::move(probe))) {
+					found = linker;
+					break;
+				}
+			}
+
+			cache[key] = found.empty() ? "-" : found;
+			std::filesystem::create_directories(cache_path.parent_path());
+			std::ofstream file(cache_path, std::ios::app);
+			file << cache[key] << ' ' << key << '\n';
+			return found;
+		}
+	}
+
+	namespace details
+	{
+		// Whether compiler accepts given flags, answers are cached for the duration of the run
+		inline bool compiler_accepts(std::vector<std::string> const& compiler, std::vector<std::string> const& flags)
+		{
+			static std::map<std::vector<std::string>, bool> cache;
+
+			auto probe = compiler;
+			make::append(probe, flags, "-E", "-x", "c++", "/dev/null");
+			if (auto it = cache.find(probe); it != cache.end()) {
+				return it->second;
+			}
+			return cache[probe] = bool(run_quietly(probe));
+		}
+
+		// Directories compiler searches for headers on its own (like the one with <vector>), as printed by -v.
+		// Answers are cached for the duration of the run.
+		inline std::vector<std::filesystem::path> compiler_include_paths(std::string const& compiler)
+		{
+			static std::map<std::string, std::vector<std::filesystem::path>> cache;
+			if (auto it = cache.find(compiler); it != cache.end()) {
+				return it->second;
+			}
+
+			auto &paths = cache[compiler];
+			auto const captured = Cmd{compiler, "-E", "-x", "c++", "-v", "/dev/null"}.capture(Cmd::Stderr::Separate);
+			bool in_list = false;
+			for (auto line : captured.err | std::views::split('\n')) {
+				std::string_view const text(line.begin(), line.end());
+				if (text.ends_with("search starts here:")) {
+					in_list = true;
+				} else if (text.starts_with("End of search list.")) {
+					in_list = false;
+				} else if (in_list && text.starts_with(' ')) {
+					paths.emplace_back(text.substr(1));
+				}
+			}
+			return paths;
+		}
+
+		// Removes least recently modified files from directory until its size fits in the limit
+		inline void prune_cache(std::filesystem::path const& directory, std::uintmax_t max_size)
+		{
+			std::error_code ec;
+			std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::directory_entry>> files;
+			std::uintmax_t total = 0;
+			for (auto const& entry : std::filesystem::recursive_directory_iterator(directory, ec)) {
+				if (entry.is_regular_file(ec)) {
+					total += entry.file_size(ec);
+					files.emplace_back(entry.last_write_time(ec), entry);
+				}
+			}
+
+			std::ranges::sort(files, {}, [](auto const& file) { return file.first; });
+			for (auto const& [_, file] : files) {
+				if (total <= max_size) break;
+				total -= file.file_size(ec);
+				std::filesystem::remove(file.path(), ec);
+			}
+		}
+	}
+
+	// Link time optimization configuration. ThinLTO is used when compiler supports it,
+	// with cache that lets relinks skip code generation of unchanged modules.
+	struct Lto
+	{
+		// Cache directory kept between builds
+		std::filesystem::path cache = ".make/lto-cache";
+
+		// Cache is pruned to this size (in bytes) before each link
+		std::uintmax_t cache_size = std::uintmax_t(1) << 30;
+
+		// Number of backend threads, taken from executor as slots. 0 means all of them
+		unsigned jobs = 0;
+	};
+
+	// Linking configuration for executables
+	struct Linking
+	{
+		// Value of -fuse-ld, empty means the fastest available one
+		std::string linker{};
+
+		// Put debug information into separate .dwo files (skipped by the linker) and index them at link time.
+		// Greatly reduces link time of debug builds.
+		bool split_dwarf = false;
+
+		std::optional<Lto> lto{};
+
+		// Flags that must be passed when compiling objects that will be linked
+		std::vector<std::string> compile_flags(std::vector<std::string> const& compiler) const
+		{
+			std::vector<std::string> flags;
+			if (split_dwarf) {
+				flags.push_back("-gsplit-dwarf");
+			}
+			if (lto) {
+				flags.push_back(details::compiler_accepts(compiler, { "-flto=thin" }) ? "-flto=thin" : "-flto");
+			}
+			return flags;
+		}
+
+		// Flags that must be passed when linking with given compiler driver, running LTO backend with lto_jobs threads
+		std::vector<std::string> link_flags(std::vector<std::string> const& compiler, unsigned lto_jobs = 1) const
+		{
+			auto const selected = linker.empty() ? linker::fastest(compiler) : linker;
+
+			std::vector<std::string> flags;
+			if (!selected.empty()) {
+				flags.push_back("-fuse-ld=" + selected);
+			}
+			if (split_dwarf) {
+				flags.push_back("-gsplit-dwarf");
+				if (linker::supports_gdb_index(selected)) {
+					flags.push_back("-Wl,--gdb-index");
+				}
+			}
+			if (lto) {
+				auto const cache = std::filesystem::absolute(lto->cache).string();
+				auto const jobs = std::to_string(std::max(1u, lto_jobs));
+				auto const policy = "cache_size_bytes=" + std::to_string(lto->cache_size);
+
+				if (details::compiler_accepts(compiler, { "-flto=thin" })) {
+					// lld has own options, other linkers (gold, mold, bfd) talk to LLVM through plugin options
+					std::string const prefix = selected == linker::lld ? "-Wl,--thinlto-" : "-Wl,-plugin-opt,";
+					flags.push_back("-flto=thin");
+					flags.push_back(prefix + "cache-dir=" + cache);
+					flags.push_back(prefix + "cache-policy=" + policy);
+					flags.push_back(prefix + "jobs=" + jobs);
+				} else {
+					flags.push_back("-flto=" + jobs);
+					if (details::compiler_accepts(compiler, { "-flto-incremental=" + cache })) {
+						flags.push_back("-flto-incremental=" + cache);
+					}
+				}
+			}
+			return flags;
+		}
+	};
+
+	// Schedules linking of executable from objects and libraries (given as inputs) with compiler driver,
+	// after given jobs finished.
+	Jobs::Id link(
+		Jobs &jobs,
+		std::vector<std::string> const& compiler,
+		std::filesystem::path const& executable,
+		std::vector<std::filesystem::path> const& inputs,
+		std::vector<Jobs::Id> after = {},
+		Linking const& linking = {},
+		std::vector<std::string> const& ldflags = {},
+		std::vector<std::string> const& ldlibs = {})
+	{
+		if (executable.has_parent_path()) {
+			std::filesystem::create_directories(executable.parent_path());
+		}
+
+		// LTO backend threads take executor slots, so link doesn't oversubscribe machine with compilations
+		unsigned const weight = linking.lto ? (linking.lto->jobs ? linking.lto->jobs : jobs.parallelism) : 1;
+
+		Cmd cmd{compiler, linking.link_flags(compiler, weight), ldflags, "-o", executable.string()};
+		for (auto const& input : inputs) {
+			append(cmd, input.string());
+		}
+		append(cmd, ldlibs);
+
+		return jobs.add({
+			.name = executable.string(),
+			.cmd = std::move(cmd),
+			.after = std::move(after),
+			.on_start = [lto = linking.lto](Jobs::Job&) {
+				if (lto) {
+					std::filesystem::create_directories(lto->cache);
+					details::prune_cache(lto->cache, lto->cache_size);
+				}
+				return true;
+			},
+			.weight = weight,
+			.inputs = inputs,
+			.outputs = { executable },
+		});
+	}
+
+	// Test executable run after build
+	struct Test
+	{
+		std::filesystem::path executable;
+		std::vector<std::string> args{};
+
+		// Supports GoogleTest sharding protocol (GTEST_TOTAL_SHARDS and GTEST_SHARD_INDEX environment variables)
+		bool shardable = false;
+	};
+
+	struct Test_Options
+	{
+		// Directory where output of each test (or its shard) is written
+		std::filesystem::path output = ".make/tests";
+
+		// Shardable tests are split into shards taking about this long according to build log
+		double shard_seconds = 5.0;
+	};
+
+	// Schedules running of tests in parallel after given jobs finished. Tests run longest first according
+	// to build log (unknown ones before all others), so that long tests don't end up starting last.
+	// Output of failed tests is printed after they finish. Returns ids of scheduled jobs.
+	std::vector<Jobs::Id> test(
+		Jobs &jobs,
+		std::vector<Test> tests,
+		std::vector<Jobs::Id> after = {},
+		Test_Options const& options = {})
+	{
+		auto const key = [](Test const& test) { return "test:" + test.executable.string(); };
+		auto const estimate = [&](Test const& test) {
+			auto const recorded = jobs.log ? jobs.log->seconds(key(test)) : std::nullopt;
+			return recorded.value_or(std::numeric_limits<double>::infinity());
+		};
+		std::ranges::stable_sort(tests, std::greater<>{}, estimate);
+
+		std::vector<Jobs::Id> ids;
+		for (auto const& test : tests) {
+			unsigned shards = 1;
+			if (test.shardable) {
+				auto const seconds = estimate(test);
+				shards = std::isinf(seconds) ? jobs.parallelism : unsigned(std::ceil(seconds / options.shard_seconds));
+				shards = std::clamp(shards, 1u, std::max(1u, jobs.parallelism));
+			}
+
+			// Total duration of test is recorded when all of its shards succeeded
+			auto const total = std::make_shared<std::pair<double, unsigned>>(0.0, 0u);
+
+			for (unsigned shard = 0; shard < shards; ++shard) {
+				Cmd cmd{test.executable.string(), test.args};
+				if (shards > 1) {
+					cmd.set_env("GTEST_TOTAL_SHARDS", std::to_string(shards));
+					cmd.set_env("GTEST_SHARD_INDEX", std::to_string(shard));
+				}
+
+				auto name = key(test);
+				auto output = options.output / test.executable.lexically_normal().relative_path();
+				if (shards > 1) {
+					name += " [" + std::to_string(shard + 1) + "/" + std::to_string(shards) + "]";
+					output += "." + std::to_string(shard);
+				}
+				output += ".log";
+
+				ids.push_back(jobs.add({
+					.cmd = std::move(cmd),
+					.after = after,
+					.on_finish = [&jobs, name, output, total, shards, key = key(test)](Jobs::Result const& result) {
+						if (!result.status) {
+							std::ostringstream message;
+							message << "[TEST] " << name << " failed, output (" << output.string() << "):\n" << std::ifstream(output).rdbuf();
+							auto text = std::move(message).str();
+							if (text.ends_with('\n')) text.pop_back();
+							logger.print(Logger::Level::Error, text);
+							return;
+						}
+						total->first += result.seconds;
+						if (++total->second == shards && jobs.log) {
+							jobs.log->record(key, total->first);
+						}
+					},
+					.output = output,
+				}));
+			}
+		}
+		return ids;
+	}
+
+	// Job that got slower or hungrier than its previous runs
+	struct Regression
+	{
+		std::string key;  // build log key, or header path for header_regressions
+		bool memory;      // regression of peak memory (in kB) instead of duration (in seconds)
+		double baseline;  // mean of previous runs
+		double current;
+		double z;         // distance from baseline in standard deviations, infinity when previous runs didn't vary
+	};
+
+	struct Regression_Options
+	{
+		// Previous runs required before key is considered
+		std::size_t min_samples = 5;
+
+		// Required distance from baseline in standard deviations
+		double min_z = 3;
+
+		// Required relative and absolute increase, ignoring noise of short jobs
+		double min_increase = 0.1;
+		double min_seconds = 0.05;
+		long min_rss_kb = 1024;
 	};
 
-	void append(Cmd &cmd, auto&& ...args)
-		requires requires { {append(cmd.argv, std::forward<decltype(args)>(args)...)}; }
+	namespace details
+	{
+		struct Baseline
+		{
+			std::size_t count = 0;
+			double mean = 0;
+			double variance = 0;
+		};
+
+		inline Baseline baseline(std::ranges::input_range auto &&values)
+		{
+			Baseline result;
+			double m2 = 0;
+			for (double value : values) {
+				++result.count;
+				double const delta = value - result.mean;
+				result.mean += delta / result.count;
+				m2 += delta * (value - result.mean);
+			}
+			result.variance = result.count > 1 ? m2 / (result.count - 1) : 0;
+			return result;
+		}
+
+		inline std::optional<Regression> regression(
+			std::string key,
+			bool memory,
+			Baseline const& baseline,
+			double current,
+			double min_absolute,
+			Regression_Options const& options)
+		{
+			if (baseline.count < options.min_samples || current - baseline.mean < min_absolute
+				|| current < baseline.mean * (1 + options.min_increase)) {
+				return std::nullopt;
+			}
+			double const z = baseline.variance > 0 ? (current - baseline.mean) / std::sqrt(baseline.variance) : std::numeric_limits<double>::infinity();
+			if (z < options.min_z) {
+				return std::nullopt;
+			}
+			return Regression { .key = std::move(key), .memory = memory, .baseline = baseline.mean, .current = current, .z = z };
+		}
+
+		// Headers included by file directly or not, as found by includes and resolve.
+		// Direct includes of each file are memoized in cache, so shared headers are scanned once.
+		inline std::set<std::filesystem::path> transitive_includes(
+			std::filesystem::path const& file,
+			std::vector<std::filesystem::path> const& include_paths,
+			std::map<std::filesystem::path, std::set<std::filesystem::path>> &cache)
+		{
+			auto const direct = [&](std::filesystem::path const& file) -> std::set<std::filesystem::path> const& {
+				auto [it, inserted] = cache.try_emplace(file);
+				if (inserted) {
+					for (auto const& include : includes(file)) {
+						if (auto header = resolve(include, include_paths, file.parent_path())) {
+							it->second.insert(std::move(*header));
+						}
+					}
+				}
+				return it->second;
+			};
+
+			std::set<std::filesystem::path> headers;
+			std::vector<std::filesystem::path> pending = { file };
+			while (!pending.empty()) {
+				auto const current = std::move(pending.back());
+				pending.pop_back();
+				for (auto const& header : direct(current)) {
+					if (headers.insert(header).second) pending.push_back(header);
+				}
+			}
+			return headers;
+		}
+	}
+
+	// Compares durations and peak memory of jobs run by this invocation against their previous runs
+	// kept in the build log. Only increases that are large and outside of usual noise are reported.
+	inline std::vector<Regression> regressions(Build_Log const& log, Regression_Options const& options = {})
+	{
+		std::vector<Regression> result;
+		for (auto const& key : log.updated) {
+			auto const& entry = log.entries.find(key)->second;
+			auto const seconds = details::baseline(entry.history | std::views::transform(&Build_Log::Sample::seconds));
+			if (auto found = details::regression(key, false, seconds, entry.seconds, options.min_seconds, options)) {
+				result.push_back(std::move(*found));
+			}
+
+			if (entry.max_rss_kb == 0) continue;
+			auto known_rss = entry.history | std::views::filter([](auto const& sample) { return sample.max_rss_kb > 0; });
+			auto const rss = details::baseline(known_rss | std::views::transform([](auto const& sample) { return double(sample.max_rss_kb); }));
+			if (auto found = details::regression(key, true, rss, entry.max_rss_kb, options.min_rss_kb, options)) {
+				result.push_back(std::move(*found));
+			}
+		}
+		return result;
+	}
+
+	// Attributes compile time regressions to headers: each header is judged by total compile time of units
+	// rebuilt by this invocation that include it (directly or not), against sum of their baselines.
+	// Headers are found in the same way as by includes and resolve.
+	inline std::vector<Regression> header_regressions(
+		Build_Log const& log,
+		std::vector<Compile_Unit> const& units,
+		std::vector<std::filesystem::path> const& include_paths,
+		Regression_Options const& options = {})
+	{
+		std::map<std::filesystem::path, std::set<std::filesystem::path>> resolved;
+
+		struct Total
+		{
+			details::Baseline baseline{};
+			double current = 0;
+		};
+		std::map<std::filesystem::path, Total> totals;
+
+		for (auto const& unit : units) {
+			auto const entry = log.entries.find(unit.object.string());
+			if (entry == log.entries.end() || !log.updated.contains(unit.object.string())) {
+				continue;
+			}
+			auto const unit_baseline = details::baseline(entry->second.history | std::views::transform(&Build_Log::Sample::seconds));
+			if (unit_baseline.count < options.min_samples) {
+				continue;
+			}
+
+			// Units are independent, so their means and variances add up
+			for (auto const& header : details::transitive_includes(unit.source, include_paths, resolved)) {
+				auto &total = totals[header];
+				total.baseline.count = total.baseline.count ? std::min(total.baseline.count, unit_baseline.count) : unit_baseline.count;
+				total.baseline.mean += unit_baseline.mean;
+				total.baseline.variance += unit_baseline.variance;
+				total.current += entry->second.seconds;
+			}
+		}
+
+		std::vector<Regression> result;
+		for (auto const& [header, total] : totals) {
+			if (auto found = details::regression(header.string(), false, total.baseline, total.current, options.min_seconds, options)) {
+				result.push_back(std::move(*found));
+			}
+		}
+		std::ranges::sort(result, std::greater{}, [](Regression const& r) { return r.current - r.baseline; });
+		return result;
+	}
+
+	// Prints regressions as warnings, returns true when there were none
+	inline bool report_regressions(std::vector<Regression> const& regressions)
 	{
-		append(cmd.argv, std::forward<decltype(args)>(args)...);
+		for (auto const& regression : regressions) {
+			char line[128];
+			if (regression.memory) {
+				std::snprintf(line, sizeof(line), "%ld kB -> %ld kB (+%.0f%%, z = %.1f)",
+					long(regression.baseline), long(regression.current), 100 * (regression.current / regression.baseline - 1), regression.z);
+			} else {
+				std::snprintf(line, sizeof(line), "%.2fs -> %.2fs (+%.0f%%, z = %.1f)",
+					regression.baseline, regression.current, 100 * (regression.current / regression.baseline - 1), regression.z);
+			}
+			logger.print(Logger::Level::Warning, std::string(regression.memory ? "[SLOWER] memory of " : "[SLOWER] ") + regression.key + ": " + line);
+		}
+		return regressions.empty();
 	}
 
-	namespace compiler
+	namespace details
 	{
-		inline namespace cpp
+		// Minimal pull parser of JSON, enough for reading -ftime-trace files.
+		// Malformed input sets failed and stops reading instead of panicking, since traces are only a hint.
+		struct Json_Reader
 		{
-			[[maybe_unused]] constexpr std::string_view gcc = "g++";
-			[[maybe_unused]] constexpr std::string_view clang = "clang++";
-			[[maybe_unused]] constexpr std::string_view posix = "c++";
+			std::string_view text;
+			std::size_t position = 0;
+			bool failed = false;
 
-			constexpr std::string_view current()
+			void skip_space()
 			{
-#if defined(__clang__)
-				return clang;
-#elif defined(__GNUC__)
-				return gcc;
-#else
-#error Unknown compiler
-#endif
+				while (position < text.size() && std::isspace((unsigned char)text[position])) ++position;
+			}
+
+			bool consume(char c)
+			{
+				skip_space();
+				if (position < text.size() && text[position] == c) {
+					++position;
+					return true;
+				}
+				return false;
+			}
+
+			void fail()
+			{
+				failed = true;
+				position = text.size();
+			}
+
+			std::string string()
+			{
+				std::string result;
+				if (!consume('"')) {
+					fail();
+					return result;
+				}
+				while (position < text.size() && text[position] != '"') {
+					char c = text[position++];
+					if (c == '\\' && position < text.size()) {
+						switch (c = text[position++]) {
+						break; case 'n': c = '\n';
+						break; case 't': c = '\t';
+						break; case 'r': c = '\r';
+						break; case 'b': c = '\b';
+						break; case 'f': c = '\f';
+						break; case 'u':
+							// Non ASCII characters are not expected in names of symbols and paths, keep placeholder
+							position = std::min(text.size(), position + 4);
+							c = '?';
+						}
+					}
+					result += c;
+				}
+				if (!consume('"')) fail();
+				return result;
+			}
+
+			double number()
+			{
+				skip_space();
+				double result = 0;
+				auto const [end, error] = std::from_chars(text.data() + position, text.data() + text.size(), result);
+				if (error != std::errc{}) {
+					fail();
+					return 0;
+				}
+				position = end - text.data();
+				return result;
+			}
+
+			// Calls on_member(key) for each member of object; it must read member's value
+			void object(auto &&on_member)
+			{
+				if (!consume('{')) return fail();
+				if (consume('}')) return;
+				do {
+					auto const key = string();
+					if (!consume(':')) return fail();
+					on_member(key);
+				} while (!failed && consume(','));
+				if (!consume('}')) fail();
+			}
+
+			// Calls on_element() for each element of array; it must read element
+			void array(auto &&on_element)
+			{
+				if (!consume('[')) return fail();
+				if (consume(']')) return;
+				do {
+					on_element();
+				} while (!failed && consume(','));
+				if (!consume(']')) fail();
+			}
+
+			void skip()
+			{
+				skip_space();
+				if (position >= text.size()) return fail();
+				switch (text[position]) {
+				break; case '{': object([this](auto const&) { skip(); });
+				break; case '[': array([this] { skip(); });
+				break; case '"': string();
+				break; case 't': case 'f': case 'n':
+					while (position < text.size() && std::isalpha((unsigned char)text[position])) ++position;
+				break; default: number();
+				}
+			}
+		};
+
+		inline std::string read_file(std::filesystem::path const& path)
+		{
+			std::ifstream file(path, std::ios::binary);
+			std::string content;
+
+			// Read at once when size is known, files without it (like ones in /proc) character by character
+			std::error_code ec;
+			if (auto const size = std::filesystem::file_size(path, ec); !ec && size > 0) {
+				content.resize(size);
+				file.read(content.data(), content.size());
+				content.resize(file.gcount());
+			}
+			content.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			return content;
+		}
+	}
+
+	// Compiler's own account of where compile time goes, aggregated over the whole build. Uses Clang's
+	// -ftime-trace, or GCC's -ftime-report when compiler doesn't support it. GCC reports neither headers
+	// nor instantiations, so parsing time of each unit is split between headers found by includes and
+	// resolve (in include paths of the command and of the compiler itself) proportionally to their size,
+	// and template instantiation shows up only among passes.
+	struct Time_Report
+	{
+		struct Item
+		{
+			double seconds = 0;
+			std::size_t count = 0;
+		};
+
+		// Inclusive time of parsing each header (with headers it includes)
+		std::map<std::string, Item> headers{};
+		std::map<std::string, Item> instantiations{};
+
+		// Compilation phases and passes, like "Frontend" or "phase opt and generate"
+		std::map<std::string, Item> passes{};
+
+		// Where GCC reports are stored
+		std::filesystem::path directory = ".make/time-report";
+
+		// Adds timing flags to compile commands of given jobs and collects timings when they finish.
+		// Report must outlive Jobs::run. Output of GCC jobs without own output file is captured,
+		// diagnostics from it are printed after the job.
+		void instrument(Jobs &jobs, std::vector<Jobs::Id> const& ids)
+		{
+			for (auto id : ids) {
+				auto &job = jobs.jobs[id];
+				if (job.cmd.argv.empty()) continue;
+
+				auto const cwd = job.cmd.cwd.empty() ? std::filesystem::current_path() : std::filesystem::absolute(job.cmd.cwd);
+				std::optional<std::filesystem::path> object;
+				std::vector<std::filesystem::path> sources, include_paths;
+				for (auto it = job.cmd.argv.begin() + 1; it != job.cmd.argv.end(); ++it) {
+					std::string_view const arg = *it;
+					if (arg == "-o" && it + 1 != job.cmd.argv.end()) {
+						object = cwd / *++it;
+					} else if (arg == "-I" || arg == "-iquote" || arg == "-isystem") {
+						if (it + 1 != job.cmd.argv.end()) include_paths.push_back(cwd / *++it);
+					} else if (arg.starts_with("-I")) {
+						include_paths.push_back(cwd / arg.substr(2));
+					} else if (!arg.starts_with('-')) {
+						auto const extension = std::filesystem::path(arg).extension();
+						if (std::ranges::find(extensions::cpp_implementation, extension) != std::end(extensions::cpp_implementation)
+							|| std::ranges::find(extensions::c_implementation, extension) != std::end(extensions::c_implementation)) {
+							sources.push_back(cwd / arg);
+						}
+					}
+				}
+				if (sources.empty()) continue;
+
+				std::function<void()> collect;
+				if (details::compiler_accepts({ job.cmd.argv.front() }, { "-ftime-trace" })) {
+					append(job.cmd, "-ftime-trace");
+					// Trace is written next to the object
+					std::vector<std::filesystem::path> traces;
+					if (object) {
+						traces.push_back(std::filesystem::path(*object).replace_extension(".json"));
+					} else {
+						for (auto const& source : sources) traces.push_back(cwd / source.filename().replace_extension(".json"));
+					}
+					collect = [this, traces] {
+						for (auto const& trace : traces) add_trace(details::read_file(trace));
+					};
+				} else {
+					append(job.cmd, "-ftime-report");
+					// Standard library headers are often the most expensive ones
+					std::ranges::copy(details::compiler_include_paths(job.cmd.argv.front()), std::back_inserter(include_paths));
+					bool const captured = job.output.empty();
+					if (captured) {
+						job.output = directory / (std::to_string(id) + ".txt");
+					}
+					collect = [this, output = job.output, captured, sources, include_paths] {
+						auto diagnostics = add_report(details::read_file(output), sources, include_paths);
+						if (captured && !diagnostics.empty()) {
+							if (diagnostics.ends_with('\n')) diagnostics.pop_back();
+							logger.print(Logger::Level::Warning, diagnostics);
+						}
+					};
+				}
+
+				job.on_finish = [collect = std::move(collect), previous = std::move(job.on_finish)](Jobs::Result const& result) {
+					collect();
+					if (previous) previous(result);
+				};
+			}
+		}
+
+		// Adds events of single -ftime-trace file
+		void add_trace(std::string_view json)
+		{
+			details::Json_Reader reader{ .text = json };
+			reader.object([&](std::string const& key) {
+				if (key != "traceEvents") return reader.skip();
+				reader.array([&] {
+					std::string name, detail;
+					double microseconds = 0;
+					reader.object([&](std::string const& key) {
+						if (key == "name") name = reader.string();
+						else if (key == "dur") microseconds = reader.number();
+						else if (key == "args") reader.object([&](std::string const& key) {
+							if (key == "detail") detail = reader.string();
+							else reader.skip();
+						});
+						else reader.skip();
+					});
+
+					Item *item = nullptr;
+					if (name == "Source") item = &headers[detail];
+					else if (name.starts_with("Instantiate")) item = &instantiations[detail];
+					else if (name.starts_with("Total ")) item = &passes[name.substr(6)];
+					if (item) {
+						item->seconds += microseconds / 1e6;
+						++item->count;
+					}
+				});
+			});
+		}
+
+		// Adds -ftime-report output of compiler run for given sources (one report per source, in order).
+		// Returns rest of the output, that is diagnostics of the compiler.
+		std::string add_report(
+			std::string_view output,
+			std::vector<std::filesystem::path> const& sources,
+			std::vector<std::filesystem::path> const& include_paths)
+		{
+			std::string diagnostics;
+			std::size_t report = 0;
+			bool in_report = false;
+			std::map<std::filesystem::path, std::set<std::filesystem::path>> resolved;
+
+			for (auto line : output | std::views::split('\n')) {
+				std::string_view const text(line.begin(), line.end());
+				if (text.starts_with("Time variable")) {
+					in_report = true;
+					continue;
+				}
+				if (!in_report) {
+					if (!text.empty() && !text.starts_with("Extra diagnostic checks enabled")
+						&& !text.starts_with("Configure with --enable-checking")) {
+						diagnostics.append(text);
+						diagnostics += '\n';
+					}
+					continue;
+				}
+				if (text.starts_with(" TOTAL")) {
+					in_report = false;
+					++report;
+					continue;
+				}
+
+				// Format: " <name> : <usr> ( <n>%) <sys> ( <n>%) <wall> ( <n>%) <memory>"
+				auto const colon = text.find(':');
+				if (colon == std::string_view::npos) continue;
+				double user, system, wall;
+				if (std::sscanf(std::string(text.substr(colon + 1)).c_str(), "%lf ( %*[^)]) %lf ( %*[^)]) %lf", &user, &system, &wall) != 3) {
+					continue;
+				}
+				auto name = std::string(text.substr(0, colon));
+				name.erase(0, name.find_first_not_of(" |"));
+				name.erase(name.find_last_not_of(' ') + 1);
+
+				auto &pass = passes[name];
+				pass.seconds += wall;
+				++pass.count;
+
+				if (name != "phase parsing" || report >= sources.size()) continue;
+
+				// Parsing time split by size of files, which roughly corresponds to amount of tokens
+				std::error_code ec;
+				auto const included = details::transitive_includes(sources[report], include_paths, resolved);
+				double total_size = double(std::filesystem::file_size(sources[report], ec));
+				for (auto const& header : included) total_size += double(std::filesystem::file_size(header, ec));
+				if (total_size <= 0) continue;
+				for (auto const& header : included) {
+					auto &item = headers[header.string()];
+					item.seconds += wall * double(std::filesystem::file_size(header, ec)) / total_size;
+					++item.count;
+				}
+			}
+			return diagnostics;
+		}
+
+		// Prints most expensive headers, instantiations and passes
+		void print(std::size_t top = 10) const
+		{
+			auto const section = [top](std::string_view title, std::map<std::string, Item> const& items) {
+				if (items.empty()) return;
+				std::vector<std::pair<std::string, Item>> sorted(items.begin(), items.end());
+				std::ranges::sort(sorted, std::greater{}, [](auto const& entry) { return entry.second.seconds; });
+				std::string text = "[TIME] " + std::string(title) + ":";
+				for (auto const& [name, item] : sorted | std::views::take(top)) {
+					char line[64];
+					std::snprintf(line, sizeof(line), "\n  %9.3fs %6zux  ", item.seconds, item.count);
+					text += line;
+					text += name;
+				}
+				logger.print(Logger::Level::Info, text);
+			};
+			section("Most expensive headers", headers);
+			section("Most expensive template instantiations", instantiations);
+			section("Most expensive passes", passes);
+		}
+	};
+
+	namespace details
+	{
+		// Encodes bytes as comma separated hex literals, 16 per line. Every byte takes exactly 5 characters,
+		// so each is written by single 8 byte store from table (overlapping the next one), word at a time
+		// instead of character at a time. Output is bound by memory bandwidth, not by encoding.
+		inline void hex_encode(std::span<unsigned char const> bytes, std::string &out)
+		{
+			static constexpr auto table = [] {
+				std::array<std::uint64_t, 256> table{};
+				constexpr std::string_view digits = "0123456789abcdef";
+				for (unsigned byte = 0; byte < 256; ++byte) {
+					char const literal[] = { '0', 'x', digits[byte >> 4], digits[byte & 15], ',' };
+					// Stored in memory order regardless of endianness
+					for (unsigned i = 0; i < std::size(literal); ++i) {
+						auto const shift = std::endian::native == std::endian::little ? 8 * i : 8 * (7 - i);
+						table[byte] |= std::uint64_t((unsigned char)literal[i]) << shift;
+					}
+				}
+				return table;
+			}();
+
+			constexpr std::size_t per_line = 16, width = 5;
+			auto const start = out.size();
+			auto const size = bytes.size() * width + (bytes.size() + per_line - 1) / per_line;
+			// Last store spills over by 3 bytes
+			out.resize(start + size + sizeof(std::uint64_t));
+
+			char *line = out.data() + start;
+			for (std::size_t offset = 0; offset < bytes.size(); offset += per_line) {
+				auto const count = std::min(per_line, bytes.size() - offset);
+				for (std::size_t i = 0; i < count; ++i) {
+					std::memcpy(line + i * width, &table[bytes[offset + i]], sizeof(std::uint64_t));
+				}
+				line += count * width;
+				*line++ = '\n';
+			}
+			out.resize(start + size);
+		}
+
+		// Writes file only when its content differs, so modification time of unchanged file (and everything
+		// depending on it) stays the same. Returns whether file was written.
+		inline bool write_if_changed(std::filesystem::path const& path, std::string_view content)
+		{
+			std::error_code ec;
+			if (std::filesystem::file_size(path, ec) == content.size() && !ec && read_file(path) == content) {
+				return false;
 			}
+			if (path.has_parent_path()) {
+				std::filesystem::create_directories(path.parent_path());
+			}
+			auto temporary = path;
+			temporary += ".tmp";
+			std::ofstream(temporary, std::ios::binary | std::ios::trunc).write(content.data(), content.size());
+			std::filesystem::rename(temporary, path);
+			return true;
+		}
+
+		// Whether compiler supports #embed directive, answers are cached for the duration of the run
+		inline bool compiler_supports_embed(std::vector<std::string> const& compiler)
+		{
+			static std::map<std::vector<std::string>, bool> cache;
+			if (auto it = cache.find(compiler); it != cache.end()) {
+				return it->second;
+			}
+
+			std::filesystem::path const probe = ".make/embed-probe.cc";
+			write_if_changed(probe, "constexpr unsigned char probe[] = {\n#embed \"embed-probe.cc\"\n};\n");
+			auto argv = compiler;
+			make::append(argv, "-fsyntax-only", probe.string());
+			return cache[compiler] = bool(run_quietly(argv));
+		}
+	}
+
+	struct Embed_Options
+	{
+		enum class Form
+		{
+			Automatic, // Embed when compiler supports it, then Object when ld is available, otherwise Array
+			Array,     // header with array initialized by hex literals
+			Embed,     // header with array initialized by #embed, compiler reads asset itself
+			Object,    // object file made by ld -r -b binary, with header declaring its symbols
+		};
+
+		Form form = Form::Automatic;
+
+		// Compiler that will compile the header, probed for #embed support
+		std::vector<std::string> compiler = { std::string(compiler::current()) };
+		std::string ld = "ld";
+	};
+
+	struct Embedded
+	{
+		Jobs::Id job;
+
+		// Object file that must be linked in, for Form::Object
+		std::optional<std::filesystem::path> object{};
+	};
+
+	// Schedules conversion of binary asset into header defining symbol with its contents. Array and Embed
+	// forms define `inline constexpr unsigned char symbol[]`, Object form defines `symbol` as
+	// `std::span<unsigned char const>` over data in the object file (next to header, with .o extension).
+	// Header is rewritten only when its content changed, so unchanged assets don't trigger recompilation.
+	inline Embedded embed(
+		Jobs &jobs,
+		std::filesystem::path const& asset,
+		std::filesystem::path const& header,
+		std::string const& symbol,
+		Embed_Options const& options = {})
+	{
+		auto form = options.form;
+		if (form == Embed_Options::Form::Automatic) {
+			if (details::compiler_supports_embed(options.compiler)) {
+				form = Embed_Options::Form::Embed;
+			} else if (details::run_quietly({ options.ld, "-v" })) {
+				form = Embed_Options::Form::Object;
+			} else {
+				form = Embed_Options::Form::Array;
+			}
+		}
+
+		// Generated files are up to date when newer than asset
+		auto const up_to_date = [asset](std::filesystem::path const& output) {
+			std::error_code ec;
+			auto const generated = std::filesystem::last_write_time(output, ec);
+			return !ec && generated >= std::filesystem::last_write_time(asset);
+		};
+
+		std::string const guard = "#pragma once\n// Generated from " + asset.string() + ", don't edit\n";
+
+		// Header keeps its modification time when its content didn't change, so time of the last check,
+		// hash of asset contents it found and what the header was generated as are kept in stamp next to it
+		auto const stamp = std::filesystem::path(header) += ".stamp";
+		auto const generated_as = symbol + (form == Embed_Options::Form::Embed ? " #embed\n" : " array\n");
+
+		if (form != Embed_Options::Form::Object) {
+			return { .job = jobs.add({
+				.name = header.string(),
+				.on_start = [=](Jobs::Job&) {
+					return !up_to_date(stamp) || !std::filesystem::exists(header) || !details::read_file(stamp).ends_with(generated_as);
+				},
+				.inputs = { asset },
+				.outputs = { header },
+				.task = [=] {
+					auto const bytes = details::read_file(asset);
+					// FNV-1a over 8 byte words, so checking touched asset is quick even in unoptimized build script
+					std::uint64_t hash = 0xcbf29ce484222325 ^ bytes.size();
+					for (std::size_t i = 0; i < bytes.size(); i += sizeof(std::uint64_t)) {
+						std::uint64_t word = 0;
+						std::memcpy(&word, bytes.data() + i, std::min(sizeof(word), bytes.size() - i));
+						hash = (hash ^ word) * 0x100000001b3;
+					}
+					char line[64];
+					std::snprintf(line, sizeof(line), "// Contents hash: %016llx\n", (unsigned long long)hash);
+					auto const key = line + generated_as;
+
+					// Only touched asset doesn't need encoding again
+					if (!std::filesystem::exists(header) || details::read_file(stamp) != key) {
+						auto content = guard;
+						if (form == Embed_Options::Form::Embed) {
+							// Hash of contents makes header change with the asset, so things including it are rebuilt
+							content += line;
+							content += "inline constexpr unsigned char " + symbol + "[] = {\n";
+							content += "#embed \"" + std::filesystem::absolute(asset).string() + "\"\n";
+						} else {
+							content += "inline constexpr unsigned char " + symbol + "[] = {\n";
+							details::hex_encode(std::span(reinterpret_cast<unsigned char const*>(bytes.data()), bytes.size()), content);
+						}
+						content += "};\n";
+						details::write_if_changed(header, content);
+					}
+					std::ofstream(stamp, std::ios::binary) << key;
+					return 0;
+				},
+			}) };
 		}
+
+		auto const object = std::filesystem::path(header).replace_extension(".o");
+
+		// ld names symbols after input path, so it runs in directory of the asset
+		std::string mangled = "_binary_" + asset.filename().string();
+		std::ranges::replace_if(mangled, [](unsigned char c) { return !std::isalnum(c); }, '_');
+
+		Cmd cmd{options.ld, "-r", "-b", "binary", "-z", "noexecstack", "-o", std::filesystem::absolute(object).string(), asset.filename().string()};
+		cmd.cwd = asset.parent_path();
+
+		return {
+			.job = jobs.add({
+				.name = object.string(),
+				.cmd = std::move(cmd),
+				.on_start = [=](Jobs::Job&) {
+					// Header no longer matches stamp of other forms
+					std::filesystem::remove(stamp);
+					details::write_if_changed(header, guard
+						+ "#include <span>\n"
+						+ "extern \"C\" unsigned char const " + mangled + "_start[], " + mangled + "_end[];\n"
+						+ "inline std::span<unsigned char const> const " + symbol + "{ " + mangled + "_start, " + mangled + "_end };\n");
+					if (object.has_parent_path()) {
+						std::filesystem::create_directories(object.parent_path());
+					}
+					return !up_to_date(object);
+				},
+				.inputs = { asset },
+				.outputs = { object },
+			}),
+			.object = object,
+		};
 	}
 
 	void rebuild_self(int argc, char **argv, std::source_location use_location = std::source_location::current())
@@ -537,12 +4513,275 @@ namespace make
 			return impl;
 		}
 	};
+
+	// Make-like variables with $(NAME) and ${NAME} references. Recursive variables (NAME = value) are
+	// expanded when referenced, simple ones (NAME := value) when defined. Expansions are memoized until
+	// any variable changes, lazy variables are computed on first reference only (useful for probes).
+	// Like in GNU make, definitions from command line take precedence over ones from build script,
+	// which take precedence over environment, which takes precedence over defaults.
+	// Supported function: $(shell command).
+	// See: https://www.gnu.org/software/make/manual/html_node/Flavors.html
+	struct Variables
+	{
+		enum class Origin { Default, Environment, Script, Command_Line };
+		enum class Flavor { Recursive, Simple };
+
+		struct Variable
+		{
+			std::string value{};
+			Flavor flavor = Flavor::Recursive;
+			Origin origin = Origin::Script;
+
+			// Computes value on first reference, result becomes simple variable
+			std::function<std::string()> compute{};
+
+			// Expanded value and generation of variables it was expanded in
+			std::optional<std::string> memo{};
+			std::size_t memo_generation = 0;
+		};
+
+		std::map<std::string, Variable, std::less<>> variables{};
+
+		// When enabled, undefined variables are looked up in process environment
+		bool use_environment = true;
+
+		// Defines recursive variable (NAME = value)
+		void set(std::string name, std::string value, Origin origin = Origin::Script)
+		{
+			define(std::move(name), { .value = std::move(value), .flavor = Flavor::Recursive, .origin = origin });
+		}
+
+		// Defines simple variable (NAME := value), expanding value immediately
+		void set_simple(std::string name, std::string_view value, Origin origin = Origin::Script)
+		{
+			auto expanded = expand(value);
+			define(std::move(name), { .value = std::move(expanded), .flavor = Flavor::Simple, .origin = origin });
+		}
+
+		// Defines variable computed on first reference
+		void set_lazy(std::string name, std::function<std::string()> compute, Origin origin = Origin::Script)
+		{
+			define(std::move(name), { .flavor = Flavor::Simple, .origin = origin, .compute = std::move(compute) });
+		}
+
+		// Appends to variable (NAME += value), keeping its flavor
+		void append(std::string const& name, std::string_view value, Origin origin = Origin::Script)
+		{
+			auto it = variables.find(name);
+			if (it == variables.end()) {
+				char const* environment = use_environment ? ::getenv(name.c_str()) : nullptr;
+				if (!environment) {
+					return set(name, std::string(value), origin);
+				}
+				// Like make, appending to environment variable extends its value
+				set(name, environment, Origin::Environment);
+				it = variables.find(name);
+			}
+			if (it->second.origin > origin) {
+				return;
+			}
+
+			auto &variable = it->second;
+			if (variable.compute) {
+				variable.value = std::exchange(variable.compute, nullptr)();
+			}
+			if (!variable.value.empty()) variable.value += ' ';
+			variable.value += variable.flavor == Flavor::Simple ? expand(value) : std::string(value);
+			++generation;
+		}
+
+		bool defined(std::string_view name) const
+		{
+			return variables.contains(name) || (use_environment && ::getenv(std::string(name).c_str()));
+		}
+
+		// Expanded value of variable, empty when undefined
+		std::string get(std::string_view name)
+		{
+			std::string result;
+			expand_variable(name, result);
+			return result;
+		}
+
+		// Expanded value split into words with shell quoting rules, ready to be used in Cmd
+		std::vector<std::string> words(std::string_view name)
+		{
+			return cmd_parse(get(name));
+		}
+
+		// Replaces references to variables in text with their values
+		std::string expand(std::string_view text)
+		{
+			std::string result;
+			expand_into(text, result);
+			return result;
+		}
+
+		// Loads NAME=value and NAME:=value arguments. Other arguments, including options (like --jobs=4), are returned
+		std::vector<std::string> load_command_line(int argc, char **argv)
+		{
+			std::vector<std::string> rest;
+			for (int i = 1; i < argc; ++i) {
+				std::string_view arg = argv[i];
+				auto const equal = arg.find('=');
+				if (equal == std::string_view::npos || equal == 0 || arg.starts_with('-')) {
+					rest.emplace_back(arg);
+					continue;
+				}
+				if (arg[equal - 1] == ':') {
+					set_simple(std::string(arg.substr(0, equal - 1)), arg.substr(equal + 1), Origin::Command_Line);
+				} else {
+					set(std::string(arg.substr(0, equal)), std::string(arg.substr(equal + 1)), Origin::Command_Line);
+				}
+			}
+			return rest;
+		}
+
+		// Variables with defaults of GNU make implicit rules that matter for C and C++
+		static Variables with_gnu_defaults()
+		{
+			Variables vars;
+			vars.set("CC", "cc", Origin::Default);
+			vars.set("CXX", "g++", Origin::Default);
+			vars.set("AR", "ar", Origin::Default);
+			vars.set("ARFLAGS", "rv", Origin::Default);
+			vars.set("COMPILE.c", "$(CC) $(CFLAGS) $(CPPFLAGS) $(TARGET_ARCH) -c", Origin::Default);
+			vars.set("COMPILE.cc", "$(CXX) $(CXXFLAGS) $(CPPFLAGS) $(TARGET_ARCH) -c", Origin::Default);
+			vars.set("LINK.cc", "$(CXX) $(CXXFLAGS) $(CPPFLAGS) $(LDFLAGS) $(TARGET_ARCH)", Origin::Default);
+			return vars;
+		}
+
+		// Implicit variables for code using gnu_implicit_variables
+		gnu_implicit_variables implicit()
+		{
+			gnu_implicit_variables impl{};
+			if (defined("CC"))  impl.cc  = words("CC");
+			if (defined("CXX")) impl.cxx = words("CXX");
+			impl.cflags   = words("CFLAGS");
+			impl.cxxflags = words("CXXFLAGS");
+			impl.cppflags = words("CPPFLAGS");
+			impl.ldflags  = words("LDFLAGS");
+			impl.ldlibs   = words("LDLIBS");
+			return impl;
+		}
+
+	private:
+		// Incremented on every change, invalidates memoized expansions
+		std::size_t generation = 1;
+
+		// Variables being expanded, to detect self references
+		std::vector<std::string_view> expanding{};
+
+		void define(std::string name, Variable variable)
+		{
+			if (auto it = variables.find(name); it != variables.end() && it->second.origin > variable.origin) {
+				return;
+			}
+			// Environment overrides defaults, so they are checked there too
+			if (variable.origin == Origin::Default && use_environment && ::getenv(name.c_str())) {
+				return;
+			}
+			variables.insert_or_assign(std::move(name), std::move(variable));
+			++generation;
+		}
+
+		void expand_variable(std::string_view name, std::string &out)
+		{
+			auto it = variables.find(name);
+			if (it == variables.end()) {
+				if (use_environment) {
+					std::string const key(name);
+					if (auto env = ::getenv(key.c_str())) out += env;
+				}
+				return;
+			}
+
+			auto &variable = it->second;
+			if (variable.compute) {
+				variable.value = std::exchange(variable.compute, nullptr)();
+			}
+			if (variable.flavor == Flavor::Simple) {
+				out += variable.value;
+				return;
+			}
+			if (variable.memo && variable.memo_generation == generation) {
+				out += *variable.memo;
+				return;
+			}
+
+			panic_if(std::ranges::find(expanding, name) != expanding.end(),
+				"Recursive variable `" + std::string(name) + "` references itself (eventually)");
+
+			expanding.push_back(it->first);
+			auto const generation_before = generation;
+			std::string expanded;
+			expand_into(variable.value, expanded);
+			expanding.pop_back();
+
+			// Expansion may define variables (lazy ones), then memo would be stale immediately
+			if (generation_before == generation) {
+				variable.memo = expanded;
+				variable.memo_generation = generation;
+			}
+			out += expanded;
+		}
+
+		void expand_into(std::string_view text, std::string &out)
+		{
+			for (std::size_t i = 0; i < text.size(); ++i) {
+				if (text[i] != '$' || i + 1 == text.size()) {
+					out += text[i];
+					continue;
+				}
+
+				char const open = text[++i];
+				if (open == '$') {
+					out += '$';
+					continue;
+				}
+				if (open != '(' && open != '{') {
+					expand_variable(text.substr(i, 1), out);
+					continue;
+				}
+
+				char const close = open == '(' ? ')' : '}';
+				auto const start = i + 1;
+				for (int depth = 1; depth > 0; ) {
+					panic_if(++i >= text.size(), "Unterminated variable reference in `" + std::string(text) + "`");
+					if (text[i] == open) ++depth;
+					if (text[i] == close) --depth;
+				}
+
+				// Reference itself may contain references, like $($(ARCH)_FLAGS)
+				auto const reference = expand(text.substr(start, i - start));
+				if (auto const space = reference.find(' '); space != std::string::npos) {
+					call_function(reference.substr(0, space), reference.substr(space + 1), out);
+				} else {
+					expand_variable(reference, out);
+				}
+			}
+		}
+
+		void call_function(std::string_view function, std::string_view argument, std::string &out)
+		{
+			if (function == "shell") {
+				auto captured = Cmd{"sh", "-c", std::string(argument)}.capture();
+				// Like make, replace newlines with spaces and drop trailing ones
+				while (captured.out.ends_with('\n')) captured.out.pop_back();
+				std::ranges::replace(captured.out, '\n', ' ');
+				out += captured.out;
+				return;
+			}
+			panic("Unsupported function `" + std::string(function) + "` in variable reference");
+		}
+	};
 }
 
 int main(int argc, char **argv)
 {
 	using namespace std::string_literals;
 
+	make::spawn_server_start();
 	make::rebuild_self(argc, argv);
 
 	/* Manual parameter loading from enviroment variables */ {